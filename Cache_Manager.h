@@ -5,39 +5,81 @@
 
 #include <sys/time.h>
 #include <iomanip>
+#include <sstream>
 #include <math.h>
 #include <stdlib.h>
 #include <fstream>
 #include <iostream>
 #include <set>
+#include <list>
+#include <map>
+#include <queue>
 #include <string>
 #include <utility>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "Driver.h"
 #include "Probability_Graph.h"
-
-#define BLOCK_SIZE 512 // bytes
+#include "Disk_Model.h"
+#include "Storage_Tier.h"
+#include "Cost_Model.h"
+#include "Miss_Ratio_Curve.h"
+#include "Predictor.h"
+#include "Snapshot_Pointer.h"
+#include "Metrics.h"
+#include "Prefetch_Analytics.h"
+#include "Time_Series.h"
 
 #define DOUBLE_ZERO 0.0000000000001
 
-/* define all times in microseconds */ 
-/* simulate a vendors hardware */
+/* all times, the prefetch horizon and the block size come from the cost model ( see Cost_Model.h ) */
+
+/* page accesses between two repartitions of the cache and prefetch buffers */
+
+#define REPARTITION_EPOCH 128
+
+/* how much larger one buffer's marginal hits must be before pages move to it */
+
+#define REPARTITION_TOLERANCE 0.1
+
+/* moves in one direction after which the step doubles again ( it halves when the direction reverses ) */
+
+#define REPARTITION_REGROW 3
+
+/* predicted files up to this size are read together with the others from their directory or pipeline */
 
-/* conigurable delay variables */
+#define GROUP_FILE_BYTES 16384
 
-#define t_disk 8900 // Samsung Serial ATA 320 gb 16mb of DRAM as a buffer ( 8.9 ms delay )
-#define t_cpu  100 // inter-access CPU time of application ( 1000 system calls per second average )
-#define t_hit  50 // time to read a several kilobytes from cache
-#define t_driver 500 // time to allocate new pages ???????????????????????????
+/* most bytes read by one grouped prefetch */
 
-/* formulas for cost/benefit analysis in microseconds */
+#define GROUP_MAX_BYTES 262144
 
-#define prefetch_horizon (t_disk/(t_cpu + t_hit + t_driver) ) // number of simultaneous prefetches to pipeline
-#define prefetch_ttl t_disk + t_cpu  //in microseconds 
+/* z of the confidence bound on a node's successor probabilities ( 95% ) */
 
+#define WILSON_Z 1.96
 
-/* Tunable variables for Weigted Moving Averages */
+/* prefetches remembered per node before the older ones count half */
 
-#define gamma 0.50 // for the weighted moving cache and prefetch hit ratio
+#define FEEDBACK_WINDOW 32
+
+/* most calls kept in the lookahead history ( must be a power of two ) */
+
+#define CALL_WINDOW_CAPACITY 1024
+
+/* a background trainer publishes a snapshot of the graph after this many opens, or once the oldest */
+/* one it has not published waited GRAPH_SNAPSHOT_DELAY seconds */
+
+#define GRAPH_SNAPSHOT_INTERVAL 256
+#define GRAPH_SNAPSHOT_DELAY 0.01
+
+/* read ahead of sequential reads ( bytes ) : the window starts at READAHEAD_MIN and doubles up to READAHEAD_MAX */
+/* a predicted file that is read by reads is prefetched up to READAHEAD_MAX, the read ahead brings in the rest */
+
+#define READAHEAD_MIN 16384
+#define READAHEAD_MAX 131072
 
 using namespace std;
 
@@ -58,10 +100,6 @@ struct Timestamp
 		/* seconds since Jan 1970 */
 		time =  now.tv_sec + (now.tv_usec*.000001);	
 	}
-	void prefetchStamp()
-	{
-		time = time - (double)t_disk*0.000001;
-	}
 };
 
 bool operator<( const Timestamp& lhs, const Timestamp& rhs)
@@ -70,8 +108,11 @@ bool operator<( const Timestamp& lhs, const Timestamp& rhs)
 struct Page
 {
 	Timestamp timestamp;
+	Timestamp ready; // when the block arrives from the device
 	SystemCall *file;
 	int block_num;
+	int owner; // the stream that brought the block in
+	int source; // id of the node that predicted a prefetched block
 		
 	bool operator==(const Page &other) const {
     	if( (*this).file->file.compare(other.file->file) == 0 && (*this).block_num == other.block_num )
@@ -89,63 +130,182 @@ struct Page
 
 }; 
 
+/* buffers are kept in time order, oldest first ( pages are found by key, see PageIndex ) */
 struct pageComparison {
   bool operator() (const Page& lhs, const Page& rhs) const
   {	 
-
-	 /* for the same file name */
-	 if( lhs.file->file == rhs.file->file )
-	 {
-		if( lhs.block_num < rhs.block_num )
-			return true;
-		else
-			return false;	
-	 }
-	 /* for different file names */
-	 else
+	 if( lhs.timestamp.time != rhs.timestamp.time )
 		return (lhs.timestamp.time < rhs.timestamp.time);
+	 /* the blocks of a file stamped together stay next to each other */
+	 int order = lhs.file->file.compare( rhs.file->file );
+	 if( order != 0 )
+		return order < 0;
+	 return lhs.block_num < rhs.block_num;
   }
 
 };
 
+/* pages of a buffer by their place in it */
+struct pageIteratorComparison {
+  bool operator() ( set<Page, pageComparison>::iterator lhs, set<Page, pageComparison>::iterator rhs ) const
+  { return pageComparison()( *lhs, *rhs ); }
+};
+typedef set< set<Page, pageComparison>::iterator, pageIteratorComparison > PageOrder;
+
+/* ( file, block ) -> the page in a buffer */
+typedef pair<string, int> PageKey;
+typedef map< PageKey, set<Page, pageComparison>::iterator > PageIndex;
+
+PageKey keyOf( const Page &page )
+{ return PageKey( page.file->file, page.block_num ); }
+
+/* keys of pages recently evicted from a buffer : a hit here is a hit the buffer would have had with more pages */
+struct GhostList
+{
+	typedef pair<string, int> Key;
+	list<Key> order; // oldest first
+	map< Key, list<Key>::iterator > index;
+	long capacity; // pages
+
+	GhostList()
+	{ capacity = 0; }
+
+	void insert( const Page &page )
+	{
+		Key key( page.file->file, page.block_num );
+		remove( page );
+		order.push_back( key );
+		index[key] = --order.end();
+		while( (long)order.size() > capacity ) {
+			index.erase( order.front() );
+			order.pop_front();
+		}
+	}
+
+	/* true if the page was recently evicted */
+	bool remove( const Page &page )
+	{
+		map< Key, list<Key>::iterator >::iterator it = index.find( Key( page.file->file, page.block_num ) );
+		if( it == index.end() )
+			return false;
+		order.erase( it->second );
+		index.erase( it );
+		return true;
+	}
+};
+
+/* the pages and hits of the accesses of one process or program */
+struct StreamStats
+{
+	string name;
+	double weight; // share of the cache under fair sharing
+	long quota; // most cached pages, 0 : no limit
+	long cached, prefetched; // resident pages
+	long hits, misses, prefetch_hits, prefetch_issued; // pages
+
+	StreamStats()
+	{
+		weight = 1;
+		quota = 0;
+		cached = 0;
+		prefetched = 0;
+		hits = 0;
+		misses = 0;
+		prefetch_hits = 0;
+		prefetch_issued = 0;
+	}
+};
+
 struct Cache
 {
 	set< Page, pageComparison> buffer;
+	GhostList ghost;
+	long ghost_hits; // this repartition epoch
 	long capacity; // pages
 	long pages_available; // pages
 	int hit_count, miss_count;
 	double last_hit_ratio;
 	double delta_ratio;
 
+	PageIndex index;
+	/* the pages of each stream in buffer order ( kept once trackOwners() is called ), so the oldest */
+	/* page of a stream is found without a scan of the buffer */
+	bool by_owner;
+	vector<PageOrder> owned;
+
+	void trackOwners()
+	{ by_owner = true; }
+	/* the least recently used page of a stream, buffer.end() if it has none */
+	set<Page>::iterator oldest( int owner )
+	{
+		if( !by_owner || owner >= owned.size() || owned[owner].empty() )
+			return buffer.end();
+		return *owned[owner].begin();
+	}
+	void own( set<Page>::iterator it )
+	{
+		if( !by_owner )
+			return;
+		if( (*it).owner >= owned.size() )
+			owned.resize( (*it).owner + 1 );
+		owned[(*it).owner].insert( it );
+	}
+	void disown( set<Page>::iterator it )
+	{
+		if( by_owner && (*it).owner < owned.size() )
+			owned[(*it).owner].erase( it );
+	}
+
 	/* check to see if BLOCK is in our buffer */
 	bool isCached( Page page)
 	{
-		if(buffer.count( page ))
+		if(index.count( keyOf( page ) ))
 			return true;
 		else
 			return false;
 	}
 
-	/* insert a page into the buffer */
+	/* insert a page into the buffer, a page that is already there becomes the most recently used */
 	pair<bool, Page> insert ( Page page )
 	{
 		pair<bool, Page> return_val;
+		PageIndex::iterator found = index.find( keyOf( page ) );
+		if( found != index.end() )
+		{
+			return_val.first = false;
+			return_val.second = *found->second;
+			page.ready = return_val.second.ready;
+			page.owner = return_val.second.owner;
+			disown( found->second );
+			buffer.erase( found->second );
+			found->second = buffer.insert( page ).first;
+			own( found->second );
+			return return_val;
+		}
 		/* insert the page into the cache */
-		pair< set<Page>::iterator, bool> result;
-		result = buffer.insert(page);
-		return_val.first = result.second;
-		return_val.second = *result.first;
+		set<Page>::iterator it = buffer.insert(page).first;
+		index[ keyOf( page ) ] = it;
+		own( it );
+		return_val.first = true;
+		return_val.second = *it;
 		return return_val;
 	}	
+	void erase( set<Page>::iterator it )
+	{
+		disown( it );
+		index.erase( keyOf( *it ) );
+		buffer.erase( it );
+	}
 	/* get the weighted cache hit ratio */
 	double update_hit_ratio()
 	{
-		cout << "Updating Last Hit Ratio..." << endl;
+		VERBOSE( cout << "Updating Last Hit Ratio..." << endl; )
 		if( hit_count == 0)
 			return 0;
 		else {
 			double current = ((double)hit_count / (hit_count + miss_count));
-			last_hit_ratio =  ((double)(1 - gamma)*last_hit_ratio) + (double)gamma*current;
+			last_hit_ratio =  ((double)(1 - cost_model.gamma)*last_hit_ratio) + (double)cost_model.gamma*current;
+			return last_hit_ratio;
 		}
 	}
 	double get_current_hit_ratio()
@@ -154,7 +314,7 @@ struct Cache
 			return 0;
 		else {
 			double current = ((double)hit_count / (hit_count + miss_count));
-			return ((double)(1 - gamma)*last_hit_ratio) + (double)gamma*current;
+			return ((double)(1 - cost_model.gamma)*last_hit_ratio) + (double)cost_model.gamma*current;
 		}
 	}
 	double get_last_hit_ratio()
@@ -166,13 +326,17 @@ struct Cache
 struct Prefetch
 {
 	set< Page, pageComparison > buffer;
+	GhostList ghost; // prefetched pages evicted before they were used
+	long ghost_hits; // this repartition epoch
 	long capacity; // pages
 	long pages_available; // pages
 	int hit_count, miss_count;
 	double last_hit_ratio;
+	PageIndex index;
+
 	bool isPrefetched( Page page)
 	{
-		if( buffer.count(page))
+		if( index.count( keyOf( page ) ))
 			return true;
 		else
 			return false;
@@ -182,13 +346,25 @@ struct Prefetch
 	pair<bool, Page> insert ( Page page )
 	{
 		pair<bool, Page> return_val;
+		PageIndex::iterator found = index.find( keyOf( page ) );
+		if( found != index.end() )
+		{
+			return_val.first = false;
+			return_val.second = *found->second;
+			return return_val;
+		}
 		/* insert the page into the cache */
-		pair< set<Page>::iterator, bool> result;
-		result = buffer.insert(page);
-		return_val.first = result.second;
-		return_val.second = *result.first;
+		set<Page>::iterator it = buffer.insert(page).first;
+		index[ keyOf( page ) ] = it;
+		return_val.first = true;
+		return_val.second = *it;
 		return return_val;
 	}	
+	void erase( set<Page>::iterator it )
+	{
+		index.erase( keyOf( *it ) );
+		buffer.erase( it );
+	}
 
 	/* get the weighted cache hit ratio */
 	double update_hit_ratio()
@@ -197,7 +373,8 @@ struct Prefetch
 			return 0;
 		else {
 			double current = ((double)hit_count / (hit_count + miss_count));
-			last_hit_ratio =  ((double)(1 - gamma)*last_hit_ratio) + (double)gamma*current;
+			last_hit_ratio =  ((double)(1 - cost_model.gamma)*last_hit_ratio) + (double)cost_model.gamma*current;
+			return last_hit_ratio;
 		}
 	}
 	double get_current_hit_ratio()
@@ -206,7 +383,7 @@ struct Prefetch
 			return 0;
 		else {
 			double current = ((double)hit_count / (hit_count + miss_count));
-			return ((double)(1 - gamma)*last_hit_ratio) + (double)gamma*current;
+			return ((double)(1 - cost_model.gamma)*last_hit_ratio) + (double)cost_model.gamma*current;
 		}
 	}
 	double get_last_hit_ratio()
@@ -216,99 +393,320 @@ struct Prefetch
 };
 
 /* window to keep a short ( lookahead period ) history of system calls for dynamic graph updates */
+/* calls arrive in time order, so the history is a circular buffer of ( Node id, time ) pairs */
 struct CallWindow
 {
-	/* duplicates not allowed here */
-	set <SystemCall*, systemCallComparison > calls;
-	void insert( SystemCall *call)
+	struct Entry
 	{
-		/* make this SystemCall an Association object */
-		Association *assoc = new Association;
-		assoc->call = call;
-		assoc->strength = 1;
-		Node *check = graph->find( call );
-		/* append the SystemCall to the end of the set [b/c ordered temporally] */
-		if ( check == NULL )
+		int id;
+		long long time; // microseconds
+	};
+	vector<Entry> ring;
+	int head, count;
+	/* to keep times increasing past midnight */
+	long long last_time, day_offset;
+
+	CallWindow()
+	{
+		ring.resize( CALL_WINDOW_CAPACITY );
+		head = 0;
+		count = 0;
+		last_time = 0;
+		day_offset = 0;
+	}
+
+	/* time of the call ( microseconds of the day ) in microseconds, never less than the last one */
+	long long timeOf( long long call_time )
+	{
+		long long time = call_time + day_offset;
+		if( time < last_time )
 		{
-			/* add it to our graph */
-			Node *new_node = new Node;	
-			new_node->call = call;
-			new_node->total_strength = 0;
-			graph->nodes.push_back( *new_node ); 
-			if( calls.size() > 1 )
+			/* more than half a day back means the trace went past midnight */
+			if( last_time - time > 43200000000LL )
 			{
-				
-				/* update everything inside the association window that comes before it */
-				for( set<SystemCall*>::iterator it = calls.begin(); it != calls.end(); it++)
-				{
-					/* add the association for this new call to each node in the window */
-					Node *ptr = graph->find( *it );
-					ptr->window.push_back( *assoc );
-					ptr->total_strength++;
-					assoc_count+= ptr->window.size();
-					graph->remove_dups(ptr->window);
-				}
+				day_offset += 86400000000LL;
+				time += 86400000000LL;
 			}
-			
-			/* insert it into our window */
-			calls.insert ( call );
+			else
+				time = last_time;
 		}
-		/* the system call already exists in our graph */
+		last_time = time;
+		return time;
+	}
+
+	/* time : when the call was made, microseconds of the day */
+	void insert( SystemCall *call, long long time )
+	{
+		/* only 'open' calls are part of the graph */
+		if( call->callType != "open" )
+			return;
+
+		const int mask = CALL_WINDOW_CAPACITY - 1;
+		long long now = timeOf( time );
+
+		/* expire the calls that are older than the lookahead period */
+		while( count && now - ring[head].time > lookahead_window )
+		{
+			head = (head + 1) & mask;
+			count--;
+		}
+
+		Node *check = graph->find( call );
+		bool is_new = ( check == NULL );
+		if( is_new )
+			check = graph->add( call );
 		else
+			graph->setCall( check, call ); // keep the data from the latest System Call
+
+		/* add the association for this call to every node in the window that comes before it */
+		for( int i = 0, j = head; i < count; i++, j = (j + 1) & mask )
 		{
-			if( calls.size() > 1 )
-			{
-				/* update everything in our association graph that comes before it */
-				for( set<SystemCall*>::iterator it = calls.begin(); it != calls.end(); it++)
-				{
-					/* add the association for this new call to each node in the window */
-					Node *ptr = graph->find( *it );
-					if( *ptr->call != *assoc->call )
-					{
-						ptr->window.push_back( *assoc );
-						ptr->total_strength++;
-					}
-					/* remove duplicate associations */
-					graph->remove_dups( ptr->window );
-				}
-			}
-			/* keep the data from the old System Call */
-			Node new_node;
-			new_node.call = call;
-			new_node.total_strength = check->total_strength;
-			/* add the stuff from the association window */
-			new_node.window.swap( check->window );
-			/* remove the old node from the graph */
-			for( vector<Node>::iterator it = graph->nodes.begin(); it != graph->nodes.end(); it++)
-			{
-				/* if the node's System Call == the system call being inserted */
-				if( (*it).call->file == call->file ) 
-				{
-					graph->nodes.erase(it);
-					break;
-				}
-			}				
-			/* add the new one to graph and call window */
-			graph->nodes.push_back(new_node);
-			calls.insert(call);
-			
+			Node *ptr = &graph->nodes[ ring[j].id ];
+			if( ptr == check )
+				continue;
+			graph->strengthen( ptr, check );
+			if( is_new )
+				assoc_count+= ptr->window.size();
+		}
+
+		/* append it, dropping the oldest call if the window is full */
+		if( count == CALL_WINDOW_CAPACITY )
+		{
+			head = (head + 1) & mask;
+			count--;
+		}
+		Entry &entry = ring[ (head + count) & mask ];
+		entry.id = check->id;
+		entry.time = now;
+		count++;
+
+	} // end insert
+};
+
+
+/* keeps the graph learning from the opens and gives prediction a view of it. without a thread the view is the graph */
+/* itself, with one the opens are learned off the demand path and the view is the latest snapshot it published */
+class Graph_Trainer
+{
+
+	private :
+	CallWindow window;
+	bool background;
+	/* opens waiting for the thread : the record the graph keeps and the time of the open */
+	deque< pair<SystemCall*, long long> > queue;
+	bool stopping;
+	mutex lock;
+	condition_variable waiting;
+	thread worker;
+	Snapshot_Pointer<Probability_Graph> published;
+	int reader; // the simulation thread
+	/* the thread's records of the files, they never change once they are queued */
+	Object_Pool<SystemCall> records;
+	map<string, SystemCall*> latest;
+
+	void run();
+	void publish();
+
+	public :
+	long snapshots, queue_peak;
+
+	Graph_Trainer();
+	~Graph_Trainer();
+	/* learn on a thread from now on */
+	void start();
+	/* learn what is queued and stop the thread */
+	void stop();
+	void insert( SystemCall* );
+	/* the graph to predict from, valid until release() */
+	Probability_Graph* acquire();
+	void release();
+	void report();
+};
+
+Graph_Trainer::Graph_Trainer()
+{
+	background = false;
+	stopping = false;
+	reader = -1;
+	snapshots = 0;
+	queue_peak = 0;
+}
+
+Graph_Trainer::~Graph_Trainer()
+{
+	stop();
+}
+
+void Graph_Trainer::start()
+{
+	if( background )
+		return;
+	reader = published.registerReader();
+	published.publish( graph->snapshot() );
+	background = true;
+	worker = thread( &Graph_Trainer::run, this );
+}
+
+void Graph_Trainer::stop()
+{
+	if( !worker.joinable() )
+		return;
+	{
+		unique_lock<mutex> guard( lock );
+		stopping = true;
+		waiting.notify_one();
+	}
+	worker.join();
+}
+
+void Graph_Trainer::insert( SystemCall *call )
+{
+	static int opens = metrics.counter( "graph.opens_learned" );
+	if( !background )
+	{
+		window.insert( call, microseconds( *call ) );
+		if( call->callType == "open" )
+			metrics.add( opens );
+		return;
+	}
+	/* only 'open' calls are part of the graph */
+	if( call->callType != "open" )
+		return;
+	/* the trace's record is rewritten by the next call to the file, the graph gets one that is not */
+	SystemCall *&record = latest[call->file];
+	if( record == NULL || record->bytes != call->bytes )
+		record = records.push_back( *call );
+
+	unique_lock<mutex> guard( lock );
+	queue.push_back( make_pair( record, microseconds( *call ) ) );
+	if( (long)queue.size() > queue_peak )
+		queue_peak = queue.size();
+	waiting.notify_one();
+}
+
+void Graph_Trainer::run()
+{
+	long learned = 0; // opens since the last snapshot
+	Timestamp first; // when the oldest of them was learned
+	unique_lock<mutex> guard( lock );
+	while( true )
+	{
+		if( !queue.empty() && learned < GRAPH_SNAPSHOT_INTERVAL )
+		{
+			pair<SystemCall*, long long> next = queue.front();
+			queue.pop_front();
+			guard.unlock();
+			window.insert( next.first, next.second );
+			static int opens = metrics.counter( "graph.opens_learned" );
+			metrics.add( opens );
+			if( !learned++ )
+				first.stamp();
+			guard.lock();
+			continue;
 		}
-		/* trim the size of the window to lookahead period */ 
-		set<SystemCall*>::iterator start = calls.begin();
-		set<SystemCall*>::iterator end = calls.end();
-		--end;
-		if( calls.size() > 1 )
+		if( learned )
 		{
-			while( (*(*end)) - (*(*start)) > (lookahead_window*0.000001) ) 
+			Timestamp now;
+			now.stamp();
+			long double waited = now.time - first.time;
+			if( learned >= GRAPH_SNAPSHOT_INTERVAL || stopping || waited >= GRAPH_SNAPSHOT_DELAY )
 			{
-				calls.erase( start );
-				start = calls.begin();
+				guard.unlock();
+				publish();
+				learned = 0;
+				guard.lock();
 			}
-		}  
+			else
+				waiting.wait_for( guard, chrono::microseconds( (long)( ( GRAPH_SNAPSHOT_DELAY - waited )*1000000 ) + 1 ) );
+			continue;
+		}
+		if( stopping )
+			break;
+		waiting.wait( guard );
+	}
+}
 
-	} // end insert
+/* copy the graph for the readers, older copies are deleted once they are done with them */
+void Graph_Trainer::publish()
+{
+	published.publish( graph->snapshot() );
+	snapshots++;
+	static int published_snapshots = metrics.counter( "graph.snapshots" );
+	metrics.add( published_snapshots );
+}
+
+Probability_Graph* Graph_Trainer::acquire()
+{
+	if( !background )
+		return graph;
+	return published.enter( reader );
+}
+
+void Graph_Trainer::release()
+{
+	if( background )
+		published.exit( reader );
+}
+
+void Graph_Trainer::report()
+{
+	if( background )
+		cout << "Graph Snapshots Published : " << snapshots << " Most Opens Waiting To Be Learned : " << queue_peak << endl;
+}
+
+/* how the prefetches predicted by one node turned out */
+struct NodeFeedback
+{
+	double expected; // sum of the chances they were issued with
+	double used;
+
+	NodeFeedback()
+	{
+		expected = 0;
+		used = 0;
+	}
+	/* measured over predicted hits : below 1 for a node that promises more than it delivers */
+	double calibration() const
+	{ return ( used + 1 )/( expected + 1 ); }
 };
 
+/* lower end of the Wilson score interval of successes out of trials */
+double wilsonLowerBound( double successes, double trials )
+{
+	if( trials <= 0 )
+		return 0;
+	double p = successes/trials;
+	double z2 = WILSON_Z*WILSON_Z;
+	double centre = p + z2/( 2*trials );
+	double spread = WILSON_Z*sqrt( p*( 1 - p )/trials + z2/( 4*trials*trials ) );
+	return ( centre - spread )/( 1 + z2/trials );
+}
+
+/* sequential read detection of one file, reset when it is opened */
+struct ReadStream
+{
+	long pages; // in the file
+	long next; // the block a sequential read starts at
+	long window; // pages read ahead, 0 after a random read
+	long ahead; // last block read ahead
+};
+
+/* a file reachable from the accessed one, ranked by the joint probability of the path to it */
+struct PrefetchCandidate
+{
+	Node *node;
+	double chance;
+	double edge; // the chance of the last hop alone, what the source node predicted
+	int depth; // accesses until it is needed
+	int source; // the node whose successor it is
+
+	bool operator<( const PrefetchCandidate &other ) const
+	{
+		if( chance != other.chance )
+			return chance < other.chance;
+		return depth > other.depth; // sooner first
+	}
+};
 
 class Cache_Manager
 {
@@ -316,7 +714,9 @@ class Cache_Manager
 	private:
 	
 	/* general variables */
-	Timestamp clock_one, clock_two;
+	Timestamp clock_one;
+	/* the buffers over trace time */
+	Time_Series series;
 
 	/* top level storage */
 	bool prefetching;
@@ -324,29 +724,125 @@ class Cache_Manager
 	long   total_pages;
 	Cache cache;
 	Prefetch prefetched;
-	CallWindow call_window;
+	/* learns the graph from the opens, prediction reads view between acquire and release */
+	Graph_Trainer trainer;
+	Probability_Graph *view;
+	Disk_Model disk;
+	/* optional second tier between the cache and the disk */
+	Storage_Tier ssd;
+	bool stage_prefetches; // prefetch into the second tier instead of memory
+	MissRatioCurve mrc;
+	/* what became of every prefetched block */
+	PrefetchAnalytics analytics;
+	/* time from each access to all of its blocks being in memory */
+	long double access_time;
+	long accesses;
+	/* per process accounting : quotas and weights by stream name */
+	vector<StreamStats> streams;
+	map<string, int> stream_index;
+	map<string, long> quotas;
+	map<string, double> weights;
+	bool fair_share;
+	int current_stream; // of the access being simulated
+	/* small predicted files waiting for the end of the prefetch pass, by directory or pipeline run */
+	map< string, vector<SystemCall*> > prefetch_groups;
+	set<SystemCall*> grouped;
+	map<SystemCall*, int> group_sources;
+	/* per node precision of the prefetches, indexed by node id */
+	vector<NodeFeedback> feedback;
+	/* picks the predictor of every node */
+	Tournament tournament;
+	long groups_issued, grouped_files;
+	/* the blocks are charged by the reads, opens only drive the graph */
+	bool read_granularity;
+	map<string, ReadStream> read_streams;
+	long readahead_requests, readahead_pages;
+	long prefetches_admitted, prefetches_rejected;
+	/* marginal utility partitioning */
+	int epoch_accesses;
+	long repartition_step, repartition_initial; // pages
+	int repartition_direction; // +1 prefetch buffer grew last, -1 cache grew last
+	int repartition_moves; // in that direction since the step last changed
 	
 	public:
 	/* constructor - param: true -> prefetching / false -> no prefetching */
 	Cache_Manager(bool, long, double, int);
 	/* default constructor */
 	Cache_Manager();
+	/* learn the graph on a thread of its own ( see Graph_Trainer ) */
+	void trainInBackground();
+	/* nodes in the graph prediction sees */
+	long nodeCount();
+	/* start from a graph built earlier ( see Graph_Builder.h ), save the one learned */
+	bool loadGraph(string);
+	bool saveGraph(string);
+	/* releases the probability graph */
+	~Cache_Manager();
 	/* allocate memory to a file */
 	bool allocate(SystemCall*); 
-	bool lruAllocate( SystemCall*, bool);
+	bool lruAllocate( SystemCall*, bool, long double, long, long, const vector<bool>* = NULL);
 	bool prefetchAllocate(Page);
+	/* charge the blocks of a read and read ahead of sequential ones */
+	bool readAllocate(SystemCall*);
+	void readahead(SystemCall*, ReadStream&, long);
+	void setReadGranularity(bool);
+	/* model a different device ( see Disk_Model.h ) */
+	void setDevice(DeviceProfile);
+	/* add a second tier of that many bytes ( see Storage_Tier.h ), optionally the target of the prefetches */
+	void setSecondTier(long, DeviceProfile, string, bool);
+	/* estimate the hit ratio of every cache size from a sample of the blocks ( see Miss_Ratio_Curve.h ) */
+	void enableMissRatioCurve(double);
+	bool recordTimeSeries(string, long long);
+	/* print the results of the simulation */
+	void report();
 	/* print cache to screen */
 	void cacheToString();
 	/* prefetching function */
 	void prefetch(SystemCall*);
-	/* function to update hit ratios */
-	void updateHitRatios();
+	/* prefetch a whole file, false if it is already cached or prefetched. small files join a group. */
+	/* the chance is the one the source node gave it, which is what its feedback is judged against */
+	bool prefetchFile(SystemCall*, int, double, string = "");
+	bool needsPrefetch(SystemCall*);
+	/* pages a prefetch of the file reads */
+	long prefetchPages(SystemCall*);
+	/* pages the prefetches land in : the prefetch buffer, or the second tier they are staged in */
+	long prefetchCapacity();
+	/* read files with one device request */
+	void issuePrefetch(vector<SystemCall*>&);
+	void flushPrefetchGroups();
+	/* cost/benefit check of prefetching a file predicted with a probability some accesses ahead */
+	bool admitPrefetch(double, SystemCall*, int);
+	/* probability of a successor that the node's evidence and its record support */
+	double confidence(Node*, int);
+	/* successors of a node from the predictor that won it */
+	void successors(Node*, int, vector<Prediction>&);
+	/* add an open to the graph and the predictors */
+	void learn(SystemCall*);
+	NodeFeedback& feedbackOf(int);
+	/* function to update hit ratios ( and sample them at the call's time ) */
+	void updateHitRatios(SystemCall*);
 	/* utility functions to check for pipelining availability */
 	void pipeline(Node*);
 	bool matrix_check(Node*, int, int);
 
 	/* resize prefetch and cache buffers according to current coniditions */
 	void repartitionBuffers();
+	void resizeBuffers(long);
+	/* evict the LRU page of a buffer into its ghost list, to make room for a prefetch of the given node ( see Prefetch_Analytics.h ) */
+	void evictCache(int = NOT_DISPLACED);
+	void evictPrefetch(int = NOT_DISPLACED, bool = false);
+	/* insert a page into a buffer and charge it to its stream */
+	pair<bool, Page> cacheInsert(Page);
+	pair<bool, Page> prefetchInsert(Page);
+	/* keep a block in the second tier, a staged prefetch if a node predicted it ( source >= 0 ) */
+	void tierInsert(SystemCall*, int, long double, int);
+	/* per process accounting */
+	void setStreamPolicy(map<string, long>, map<string, double>, bool);
+	int streamOf(SystemCall*);
+	/* charge the hits and misses since the counts given to the stream and the metrics */
+	void countAccess(int, int, int, int);
+	/* the stream that gives up a cached page, -1 for plain LRU */
+	int victimStream();
 			
 };
 
@@ -357,6 +853,13 @@ Cache_Manager::Cache_Manager()
 	prefetching = false;
 }
 
+Cache_Manager::~Cache_Manager()
+{
+	trainer.stop();
+	delete graph;
+	graph = NULL;
+}
+
 Cache_Manager::Cache_Manager(bool tmp, long size_in_bytes, double minChance, int lookahead)
 {
 	/* initialize parameters */
@@ -372,18 +875,38 @@ Cache_Manager::Cache_Manager(bool tmp, long size_in_bytes, double minChance, int
 	prefetched.miss_count = 0;
 	prefetched.last_hit_ratio = 0;
 	assoc_count = 0;
+	prefetches_admitted = 0;
+	prefetches_rejected = 0;
+	cache.ghost_hits = 0;
+	cache.by_owner = false;
+	prefetched.ghost_hits = 0;
+	epoch_accesses = 0;
+	repartition_direction = 0;
+	repartition_moves = 0;
+	stage_prefetches = false;
+	access_time = 0;
+	accesses = 0;
+	fair_share = false;
+	current_stream = 0;
+	groups_issued = 0;
+	grouped_files = 0;
+	read_granularity = false;
+	readahead_requests = 0;
+	readahead_pages = 0;
 
 	/* initialize clocks */
 	clock_one.stamp();
-	clock_two.stamp();	
+
+	/* every request takes t_disk unless another device is set */
+	disk = Disk_Model( deviceProfile( "fixed", cost_model.disk ) );
 
 	/* load our probability graph */
 	graph = new Probability_Graph(lookahead_window);
 
-	total_pages = size_in_bytes/BLOCK_SIZE;	
+	total_pages = size_in_bytes/cost_model.block_size;	
 	/* initialize buffers */
 	if( prefetching ) {
-		prefetched.capacity = prefetch_horizon;
+		prefetched.capacity = cost_model.horizon;
 		prefetched.pages_available = prefetched.capacity;
 		cache.capacity = total_pages - prefetched.capacity;
 		cache.pages_available = cache.capacity;
@@ -394,6 +917,13 @@ Cache_Manager::Cache_Manager(bool tmp, long size_in_bytes, double minChance, int
 		prefetched.pages_available = 0;
 	}
 
+	/* both ghost lists see the same number of pages past their buffer, so their hits compare per page */
+	cache.ghost.capacity = total_pages/8 > 1 ? total_pages/8 : 1;
+	prefetched.ghost.capacity = cache.ghost.capacity;
+	repartition_step = total_pages/16 > 1 ? total_pages/16 : 1;
+	repartition_initial = repartition_step;
+	analytics.setLimit( total_pages );
+
 }
 
 
@@ -401,69 +931,202 @@ Cache_Manager::Cache_Manager(bool tmp, long size_in_bytes, double minChance, int
 bool Cache_Manager::allocate( SystemCall *file)
 {
 
-	cout << file->file << endl;
+	VERBOSE( cout << file->file << endl; )
 	/* update hit ratios for weighted moving averages */
-	updateHitRatios();
+	updateHitRatios( file );
+	/* track the real inter-access time ( and so the prefetch horizon and ttl ) */
+	bool read = ( file->callType == "read" );
+	if( !read )
+		cost_model.observe( microseconds( *file ) );
+
+	/* charge the pages and hits of this access to its process */
+	current_stream = streamOf( file );
+	int hits = cache.hit_count, misses = cache.miss_count;
+	int prefetch_hits = prefetched.hit_count, prefetch_misses = prefetched.miss_count;
+
+	/* the reads bring in the blocks, the graph only sees the opens */
+	if( read_granularity )
+	{
+		bool result = true;
+		if( prefetching )
+			repartitionBuffers();
+		if( read )
+			result = readAllocate( file );
+		else
+		{
+			ReadStream &stream = read_streams[file->file];
+			stream.pages = ceil( (double)file->bytes/cost_model.block_size );
+			stream.next = 1;
+			stream.window = 0;
+			stream.ahead = 0;
+			if( prefetching )
+			{
+				view = trainer.acquire();
+				learn( file );
+				prefetch( file );
+				trainer.release();
+			}
+		}
+		countAccess( hits, misses, prefetch_hits, prefetch_misses );
+		return result;
+	}
 
 	/* LRU Management */
 	if( !prefetching )
 	{
-		return lruAllocate( file, false );
+		bool result = lruAllocate( file, false, 0, 1, ceil( (double)file->bytes/cost_model.block_size ) );
+		countAccess( hits, misses, prefetch_hits, prefetch_misses );
+		return result;
 	}
 	/* LRU with prefetching */
 	else
 	{
+		/* move pages to the buffer that gains the most hits from them */
+		repartitionBuffers();
 		/* add the call to our call window and dynamically update the probability graph */
-		call_window.insert( file );
+		view = trainer.acquire();
+		learn( file );
 		/* prefetch calls that are in the lookahead window */
 		prefetch( file );
+		trainer.release();
 		
 					
 		/* delete all blocks with this file name from the prefetch buffer */
 		bool found = false;
 		bool isLoaded = false;
 		bool isPrefetched = false;
+		long double arrival = 0;
 		Timestamp now;
 		now.stamp();
-		for( set<Page>::iterator it = prefetched.buffer.begin(); it != prefetched.buffer.end(); it++)
+		for( int block = 1; block <= ceil( (double)file->bytes/cost_model.block_size ); block++ )
 		{
-			if( *file ==  *(*it).file)
-			{
-				prefetched.buffer.erase(it);
-				prefetched.pages_available++;
-				found = true;
-
-				if( (now.time - (*it).timestamp.time) >= (double)t_disk*0.000001 )
-					isLoaded = true;
-
-			}
-			/* this works because all the cached blocks for a file are sequential */
-			if( found && !(*file ==  *(*it).file)  )
-				break;
+			PageIndex::iterator page = prefetched.index.find( PageKey( file->file, block ) );
+			if( page == prefetched.index.end() )
+				continue;
+			set<Page>::iterator it = page->second;
+			/* the node that predicted it was right */
+			if( !found )
+				feedbackOf( (*it).source ).used++;
+			found = true;
+			if( now.time >= (*it).ready.time )
+				isLoaded = true;
+			else if( (*it).ready.time > arrival )
+				arrival = (*it).ready.time;
+			analytics.used( PrefetchAnalytics::Key( file->file, block ), now.time );
+			streams[(*it).owner].prefetched--;
+			prefetched.erase( it );
+			prefetched.pages_available++;
 		}
 		if( found && isLoaded )
 		{
-			prefetched.hit_count += ceil(file->bytes/BLOCK_SIZE);
+			prefetched.hit_count += ceil(file->bytes/cost_model.block_size);
+			streams[current_stream].prefetch_hits += ceil(file->bytes/cost_model.block_size);
 			isPrefetched = true;
 		}
 		else
-			prefetched.miss_count += ceil(file->bytes/BLOCK_SIZE);
+			prefetched.miss_count += ceil(file->bytes/cost_model.block_size);
+
+		/* a prefetch of it was evicted before it was used */
+		if( !found )
+		{
+			Page page;
+			page.file = file;
+			for( page.block_num = 1; page.block_num <= ceil( (double)file->bytes/cost_model.block_size ); page.block_num++ )
+				if( prefetched.ghost.remove( page ) )
+					prefetched.ghost_hits++;
+		}
 			
 		
-		/* put the file into the cache because it has been called */		
-		lruAllocate( file, isPrefetched );
+		/* put the file into the cache because it has been called ( an unfinished prefetch is waited for ) */		
+		bool result = lruAllocate( file, isPrefetched, isLoaded ? 0 : arrival, 1, ceil( (double)file->bytes/cost_model.block_size ) );
+		countAccess( hits, misses, prefetch_hits, prefetch_misses );
+		return result;
 						
 	} 
 
 }
 /* Precondition : the SystemCall is not in the Cache buffer */
-bool Cache_Manager::lruAllocate( SystemCall *file, bool isPrefetched )
+/* arrival : when an unfinished prefetch of the file completes, 0 if there is none */
+/* the blocks first to first + pages_required - 1 of the file are accessed */
+/* present : which of them came out of the prefetch buffer when only some did, the others are read on demand */
+bool Cache_Manager::lruAllocate( SystemCall *file, bool isPrefetched, long double arrival, long first, long pages_required, const vector<bool> *present )
 {
 	
-	/* get the number of pages required by the file */
-	long pages_required =  ceil( ((double)(file->bytes)/ BLOCK_SIZE) );
 	/* result of insert operation */
 	pair<bool, Page> result;
+
+	/* every block of the file is a reference for the miss ratio curve */
+	if( mrc.enabled() )
+	{
+		unsigned long long hash = MissRatioCurve::hashFile( file->file );
+		for( int i = 0; i < pages_required; i++ )
+			mrc.access( hash, first + i );
+	}
+
+	/* when the blocks that are not cached will be in memory */
+	Timestamp ready;
+	ready.stamp();
+	long double start = ready.time;
+	if( arrival > ready.time )
+		ready.time = arrival;
+	if( !isPrefetched && ( present != NULL || arrival <= start ) )
+	{
+		/* read the missing blocks from the second tier or else the device, with one demand request each */
+		vector<int> missing;
+		long from_tier = 0;
+		int source = -1;
+		long double tier_ready = start;
+		for( int i = 0; i < pages_required; i++ )
+		{
+			Page page;
+			page.timestamp = ready;
+			page.file = file;
+			page.block_num = first + i;
+			if( cache.isCached( page ) || ( present != NULL && (*present)[i] ) )
+				continue;
+			if( cache.ghost.remove( page ) )
+				cache.ghost_hits++;
+			/* the first read of a staged prefetch uses it, anything else is a demand read */
+			int staged_source = -1;
+			long double staged = ssd.enabled() ? ssd.find( Storage_Tier::Key( file->file, first + i ), &staged_source ) : -1;
+			if( staged_source >= 0 )
+			{
+				source = staged_source;
+				analytics.used( PrefetchAnalytics::Key( file->file, first + i ), start );
+			}
+			else
+				analytics.demandRead( PrefetchAnalytics::Key( file->file, first + i ) );
+			if( staged < 0 )
+				missing.push_back( first + i );
+			else {
+				from_tier++;
+				if( staged > tier_ready )
+					tier_ready = staged; // a staged prefetch still on its way
+			}
+		}
+		if( from_tier )
+		{
+			long double done = ssd.device.submit( tier_ready, from_tier*cost_model.block_size, true );
+			if( done > ready.time )
+				ready.time = done;
+		}
+		/* a staged prefetch was right */
+		if( source >= 0 )
+			feedbackOf( source ).used++;
+		if( missing.size() )
+		{
+			long double done = disk.submit( start, missing.size()*cost_model.block_size, true );
+			if( done > ready.time )
+				ready.time = done;
+			/* the second tier keeps a copy of what was read from the disk */
+			for( int i = 0; ssd.enabled() && i < missing.size(); i++ )
+				tierInsert( file, missing[i], done, -1 );
+		}
+	}
+	accesses++;
+	access_time += ready.time - start + cost_model.hit*0.000001;
+	static int latency = metrics.histogram( "access.latency", "us" );
+	metrics.record( latency, ( ready.time - start )*1000000 + cost_model.hit );
 	
 	/* NOT ENOUGH MEMORY */
 	if( pages_required > cache.pages_available )
@@ -476,17 +1139,16 @@ bool Cache_Manager::lruAllocate( SystemCall *file, bool isPrefetched )
 			/* create our fake page to be inserted at the tail of the set */
 			Page new_page;
 			new_page.file = file;
-			if( !isPrefetched )
-				new_page.timestamp.stamp();
-			else
-				new_page.timestamp.prefetchStamp();
-			new_page.block_num = i+1;
+			new_page.timestamp.stamp();
+			new_page.ready = ready;
+			new_page.owner = current_stream;
+			new_page.block_num = first + i;
 			
 			/* insert a page into free cache memory ( at the tail ) */
 			if( cache.pages_available )
 			{
-				result = cache.insert( new_page ); // unless it already exists
-				if( !result.first && (now.time - result.second.timestamp.time ) >= (double)t_disk*0.000001)
+				result = cacheInsert( new_page ); // unless it already exists
+				if( !result.first && now.time >= result.second.ready.time)
 					cache.hit_count++;
 				else if( !result.first )
 					cache.miss_count++;
@@ -499,42 +1161,21 @@ bool Cache_Manager::lruAllocate( SystemCall *file, bool isPrefetched )
 			/* deallocated memory at the head of the set and add a page */
 			else
 			{
-				if( !prefetching )
-				{
-					/* deallocate LRU page */
-					set<Page>::iterator it = cache.buffer.begin();
-					cache.buffer.erase( it );
-					/* insert a page */
-					result = cache.insert( new_page );
-					/* make sure t_disk time has elapsed before it appears in the buffer */
-					if( !result.first && (now.time - result.second.timestamp.time ) >= (double)t_disk*0.000001 ) {
-						cache.hit_count++;
-						cache.pages_available++;
-					}
-					else if( !result.first )  // no need to do decrease pages available
-						cache.miss_count++;
-					else 
-						cache.miss_count++;
+				/* deallocate LRU page */
+				evictCache();
+				/* insert a page */
+				result = cacheInsert( new_page );
+				/* make sure t_disk time has elapsed before it appears in the buffer */
+				if( !result.first && now.time >= result.second.ready.time ) {
+					cache.hit_count++;
+					cache.pages_available++;
 				}
-				else
-				{
-					
-					repartitionBuffers();
-					
-					if( cache.pages_available ) {
-						result = cache.insert( new_page );
-						/* make sure t_disk time has elapsed */
-						if( !result.first && (now.time - result.second.timestamp.time ) >= (double)t_disk*0.000001 )
-							cache.hit_count++;
-						else if( !result.first ) 
-							cache.miss_count++;
-						else {
-							cache.pages_available--;
-							cache.miss_count++;
-						}
-					}		
+				else if( !result.first ) { // the evicted page was not replaced
+					cache.miss_count++;
+					cache.pages_available++;
 				}
-					
+				else 
+					cache.miss_count++;
 			}
 		} 
 		return true;
@@ -548,16 +1189,15 @@ bool Cache_Manager::lruAllocate( SystemCall *file, bool isPrefetched )
 			now.stamp();
 			/* create a fake page to be inserted with a timestamp */
 			Page new_page;
-			if( !isPrefetched )
-				new_page.timestamp.stamp();
-			else
-				new_page.timestamp.prefetchStamp();
-			new_page.block_num = i+1;
+			new_page.timestamp.stamp();
+			new_page.ready = ready;
+			new_page.owner = current_stream;
+			new_page.block_num = first + i;
 			/* make the file pointer point at the system call in the parameter of this function */
 			new_page.file = file;
-			result = cache.insert( new_page );
+			result = cacheInsert( new_page );
 			/* make sure t_disk time has elapsed */
-			if(!result.first && (now.time - result.second.timestamp.time ) >= (double)t_disk*0.000001)
+			if(!result.first && now.time >= result.second.ready.time)
 				cache.hit_count++;
 			else if( !result.first )
 				cache.miss_count++;
@@ -582,7 +1222,7 @@ bool Cache_Manager::prefetchAllocate( Page page)
 		/* IF THERE IS A PAGE AVAILABLE */
 		if( prefetched.pages_available )
 		{
-			result = prefetched.insert( page );
+			result = prefetchInsert( page );
 			prefetched.pages_available = prefetched.capacity - prefetched.buffer.size(); 
 		}
 		else
@@ -594,75 +1234,530 @@ bool Cache_Manager::prefetchAllocate( Page page)
 			/* create time elapsed for oldest prefetched item */
 			double long time_elapsed = present_time.time - (*it).timestamp.time; //seconds
 			/* if the prefetch time has expired, eject the prefetch */
-			if( (time_elapsed)*1000000 > prefetch_ttl && prefetched.buffer.size() > 0)
+			if( (time_elapsed)*1000000 > cost_model.ttl && prefetched.buffer.size() > 0)
 			{
-				prefetched.buffer.erase( it );
+				evictPrefetch( page.source, true );
 				/* insert a page - NO NEED TO CHANGE PAGES_AVAILABLE*/
-				result = prefetched.insert( page );
+				result = prefetchInsert( page );
 				prefetched.pages_available = prefetched.capacity - prefetched.buffer.size();
 			}
 			
 			/* use LRU management */
 			else
 			{
-				repartitionBuffers();
-				if( prefetched.pages_available ) {
-					result = prefetched.insert( page);
-					prefetched.pages_available = prefetched.capacity - prefetched.buffer.size();
-				}
-				else
-				{
-					set<Page>::iterator it  = prefetched.buffer.begin();
-					prefetched.buffer.erase(it);
-					result = prefetched.insert(page);
-					prefetched.pages_available = prefetched.capacity - prefetched.buffer.size();
-				}
-
+				evictPrefetch( page.source );
+				result = prefetchInsert(page);
+				prefetched.pages_available = prefetched.capacity - prefetched.buffer.size();
 			}
 
 		}		
 	
+		return true;
 	}
 	/* ELSE DO NOTHING */
-	
+	return false;
+}
+
+bool Cache_Manager::readAllocate( SystemCall *file )
+{
+	long first = file->offset/cost_model.block_size + 1;
+	long last = ( file->offset + file->bytes - 1 )/cost_model.block_size + 1;
+	ReadStream &stream = read_streams[file->file];
+
+	/* take the blocks that were read ahead ( or predicted ) out of the prefetch buffer */
+	long found = 0, loaded = 0;
+	int source = -1;
+	long double arrival = 0;
+	vector<bool> present( last - first + 1, false );
+	Timestamp now;
+	now.stamp();
+	for( long block = first; block <= last; block++ )
+	{
+		PageIndex::iterator page = prefetched.index.find( PageKey( file->file, block ) );
+		if( page == prefetched.index.end() )
+		{
+			Page ghost;
+			ghost.file = file;
+			ghost.block_num = block;
+			if( prefetched.ghost.remove( ghost ) )
+				prefetched.ghost_hits++;
+			continue;
+		}
+		set<Page>::iterator it = page->second;
+		if( (*it).source >= 0 )
+			source = (*it).source;
+		found++;
+		present[block - first] = true;
+		if( now.time >= (*it).ready.time )
+			loaded++;
+		else if( (*it).ready.time > arrival )
+			arrival = (*it).ready.time;
+		analytics.used( PrefetchAnalytics::Key( file->file, block ), now.time );
+		streams[(*it).owner].prefetched--;
+		prefetched.erase( it );
+		prefetched.pages_available++;
+	}
+	/* the node that predicted the file was right ( judged by the first read after the open ) */
+	if( source >= 0 && stream.next == 1 )
+		feedbackOf( source ).used++;
+	prefetched.hit_count += loaded;
+	prefetched.miss_count += ( last - first + 1 ) - loaded;
+	streams[current_stream].prefetch_hits += loaded;
+
+	/* a read that is only partly prefetched waits for those blocks and reads the rest on demand */
+	bool isPrefetched = ( found == last - first + 1 );
+	bool result = lruAllocate( file, isPrefetched, arrival, first, last - first + 1, found && !isPrefetched ? &present : NULL );
+
+	/* a read where the last one ended doubles the window, any other read stops the read ahead */
+	if( first == stream.next || first == stream.next - 1 )
+	{
+		long smallest = READAHEAD_MIN/cost_model.block_size;
+		long largest = READAHEAD_MAX/cost_model.block_size;
+		/* the current window and the next one share the prefetch buffer, a buffer too small for that reads nothing ahead */
+		if( largest > prefetched.capacity/2 )
+			largest = prefetched.capacity/2;
+		stream.window = stream.window ? stream.window*2 : smallest;
+		if( stream.window > largest )
+			stream.window = largest;
+	}
+	else
+	{
+		stream.window = 0;
+		stream.ahead = 0;
+	}
+	stream.next = last + 1;
+	if( prefetching && stream.window )
+		readahead( file, stream, last );
+	return result;
+}
+
+/* keep a window of blocks past the last read in flight, a new request is made once half of it is used */
+void Cache_Manager::readahead( SystemCall *file, ReadStream &stream, long last )
+{
+	if( stream.ahead - last >= stream.window/2 )
+		return;
+	long from = stream.ahead > last ? stream.ahead + 1 : last + 1;
+	long to = last + stream.window;
+	if( stream.pages && to > stream.pages )
+		to = stream.pages;
+
+	/* skip the blocks that are already in memory */
+	Page new_page;
+	new_page.file = file;
+	for( new_page.block_num = from; new_page.block_num <= to; new_page.block_num++ )
+		if( !cache.isCached( new_page ) && !prefetched.isPrefetched( new_page ) )
+			break;
+	from = new_page.block_num;
+	if( to > stream.ahead )
+		stream.ahead = to;
+	if( from > to )
+		return;
+
+	new_page.timestamp.stamp();
+	new_page.owner = current_stream;
+	new_page.source = -1; // not predicted by a node
+	new_page.ready.time = disk.submit( new_page.timestamp.time, ( to - from + 1 )*cost_model.block_size, false );
+	readahead_requests++;
+	readahead_pages += to - from + 1;
+	static int readahead_bytes = metrics.counter( "readahead.bytes" );
+	metrics.add( readahead_bytes, ( to - from + 1 )*cost_model.block_size );
+	for( new_page.block_num = from; new_page.block_num <= to; new_page.block_num++ )
+		prefetchAllocate( new_page );
 }
 
 void Cache_Manager::prefetch ( SystemCall *file)
 {	
 	
 	/* see if the file exists as a node in the graph */
-	Node *ptr = graph->find( file );
+	Node *ptr = view->find( file );
 	if( ptr == NULL )
 	{
-		cout << "File Not Found In Graph For Prefetching! " << endl;
+		VERBOSE( cout << "File Not Found In Graph For Prefetching! " << endl; )
 	}
 	else	
 	{
-		/* try to pipeline the prefetches*/
-		pipeline( ptr );
-		if( ptr->window.size() > 0 )
+		/* try to pipeline the prefetches ( when the graph predicts for this file ) */
+		if( tournament.winner( ptr->id ) == 0 )
+			pipeline( ptr );
+
+		/* best-first walk of the graph : a file two or three hops away is needed later but its */
+		/* request has to be issued now to land in time, t_disk covers several accesses */
+		priority_queue<PrefetchCandidate> candidates;
+		NodeSet visited;
+		visited.insert( ptr->id );
+		PrefetchCandidate start;
+		start.node = ptr;
+		start.chance = 1;
+		start.edge = 1;
+		start.depth = 0;
+		start.source = ptr->id;
+		candidates.push( start );
+
+		long budget = prefetchCapacity(); // pages
+		double access_time = cost_model.cpu + cost_model.hit + cost_model.driver;
+		while( !candidates.empty() && budget > 0 )
 		{
-			for( int i = 0; i < ptr->window.size(); i++)
+			PrefetchCandidate best = candidates.top();
+			candidates.pop();
+			if( best.depth > 0 )
 			{
-				/* allocate space to the prefetched data if the strength is above minimum_chance parameter and not prefetched or cached */
-				if( (double)(ptr->window[i].strength/(double)ptr->total_strength) >= minimum_chance)
-				{
-					for( int j = 0; j < ceil( (double)(ptr->window[i].call)->bytes/BLOCK_SIZE); j++)
-					{
-						Page new_page;
-						new_page.timestamp.stamp();
-						new_page.file = ptr->window[i].call;
-						new_page.block_num = j+1;				
-						prefetchAllocate( new_page );
-					}
-				}	
-			} 
-		} 
-		
+				if( visited.contains( best.node->id ) )
+					continue;
+				visited.insert( best.node->id );
+
+				/* it would expire from the prefetch buffer before it is needed */
+				if( best.depth*access_time <= cost_model.ttl + cost_model.disk
+					&& admitPrefetch( best.chance, best.node->call, best.depth )
+					&& prefetchFile( best.node->call, best.source, best.edge ) )
+					budget -= prefetchPages( best.node->call );
+			}
+			if( best.depth >= cost_model.horizon )
+				continue;
+
+			/* successors come most likely first, so the ones worth following are a prefix of them */
+			vector<Prediction> predictions;
+			successors( best.node, best.depth ? best.source : tournament.previousOpen(), predictions );
+			for( int i = 0; i < predictions.size(); i++)
+			{
+				/* stop at the first path below the minimum_chance parameter */
+				double chance = best.chance*predictions[i].chance;
+				if( chance < minimum_chance)
+					break;
+				if( visited.contains( predictions[i].id ) )
+					continue;
+				PrefetchCandidate next;
+				next.node = &view->nodes[ predictions[i].id ];
+				next.chance = chance;
+				next.edge = predictions[i].chance;
+				next.depth = best.depth + 1;
+				next.source = best.node->id;
+				candidates.push( next );
+			}
+		}
+
+		/* one request for each group of small files */
+		flushPrefetchGroups();
+	}
+}
+
+bool Cache_Manager::needsPrefetch( SystemCall *file )
+{
+	Page page;
+	page.file = file;
+	page.block_num = 1;
+	if( file->bytes <= 0 || cache.isCached( page ) || prefetched.isPrefetched( page ) )
+		return false;
+	if( stage_prefetches && ssd.contains( Storage_Tier::Key( file->file, 1 ) ) )
+		return false;
+	/* already waiting in a group */
+	return !grouped.count( file );
+}
+
+long Cache_Manager::prefetchPages( SystemCall *file )
+{
+	long pages = ceil( (double)file->bytes/cost_model.block_size );
+	if( read_granularity && pages*cost_model.block_size > READAHEAD_MAX )
+		pages = READAHEAD_MAX/cost_model.block_size;
+	return pages;
+}
+
+long Cache_Manager::prefetchCapacity()
+{
+	return stage_prefetches ? ssd.capacity : prefetched.capacity;
+}
+
+bool Cache_Manager::prefetchFile( SystemCall *file, int source, double chance, string group )
+{
+	if( !needsPrefetch( file ) )
+		return false;
+
+	/* judged by whether it is used */
+	NodeFeedback &record = feedbackOf( source );
+	if( record.expected >= FEEDBACK_WINDOW ) {
+		record.expected /= 2;
+		record.used /= 2;
 	}
+	record.expected += chance;
+	group_sources[file] = source;
+
+	prefetches_admitted++;
+
+	/* small files wait for the others of their directory ( or pipeline run ) */
+	if( file->bytes <= GROUP_FILE_BYTES )
+	{
+		grouped.insert( file );
+		if( group == "" )
+			group = file->file.substr( 0, file->file.rfind( '/' ) + 1 );
+		prefetch_groups[group].push_back( file );
+		return true;
+	}
+
+	vector<SystemCall*> single( 1, file );
+	issuePrefetch( single );
+	return true;
 }
 
-void Cache_Manager::updateHitRatios()
+void Cache_Manager::issuePrefetch( vector<SystemCall*> &files )
+{
+	long bytes = 0;
+	for( int i = 0; i < files.size(); i++ )
+		bytes += min( files[i]->bytes, prefetchPages( files[i] )*cost_model.block_size );
+
+	Page new_page;
+	new_page.timestamp.stamp();
+	new_page.owner = current_stream;
+	/* every block of every file arrives with the one request */
+	new_page.ready.time = disk.submit( new_page.timestamp.time, bytes, false );
+	static int prefetch_requests = metrics.counter( "prefetch.requests" ), prefetch_bytes = metrics.counter( "prefetch.bytes" );
+	metrics.add( prefetch_requests );
+	metrics.add( prefetch_bytes, bytes );
+	for( int i = 0; i < files.size(); i++ )
+	{
+		long pages = prefetchPages( files[i] );
+		new_page.file = files[i];
+		new_page.source = group_sources[files[i]];
+		for( int j = 0; j < pages; j++)
+		{
+			new_page.block_num = j+1;				
+			/* stage it in the second tier, it is promoted to memory when it is read */
+			if( stage_prefetches )
+				tierInsert( files[i], j+1, new_page.ready.time, new_page.source );
+			else
+				prefetchAllocate( new_page );
+		}
+	}
+}
+
+void Cache_Manager::flushPrefetchGroups()
+{
+	for( map< string, vector<SystemCall*> >::iterator it = prefetch_groups.begin(); it != prefetch_groups.end(); it++ )
+	{
+		/* split groups that are too large for one request */
+		vector<SystemCall*> request;
+		long bytes = 0;
+		for( int i = 0; i <= it->second.size(); i++ )
+		{
+			if( i == it->second.size() || ( request.size() && bytes + it->second[i]->bytes > GROUP_MAX_BYTES ) )
+			{
+				if( request.size() > 1 ) {
+					groups_issued++;
+					grouped_files += request.size();
+				}
+				issuePrefetch( request );
+				request.clear();
+				bytes = 0;
+				if( i == it->second.size() )
+					break;
+			}
+			request.push_back( it->second[i] );
+			bytes += it->second[i]->bytes;
+		}
+	}
+	prefetch_groups.clear();
+	grouped.clear();
+	group_sources.clear();
+}
+
+/* the successors the winning predictor of the node gives, most likely first ( previous : the node opened before it ) */
+void Cache_Manager::successors( Node *node, int previous, vector<Prediction> &predictions )
+{
+	if( tournament.winner( node->id ) == 0 )
+	{
+		for( int i = 0; i < node->window.size(); i++ )
+		{
+			Prediction prediction;
+			prediction.id = node->window[i].id;
+			prediction.chance = confidence( node, i );
+			predictions.push_back( prediction );
+		}
+		return;
+	}
+	tournament.predict( previous, node, predictions );
+	double calibration = feedbackOf( node->id ).calibration();
+	for( int i = 0; i < predictions.size(); i++ )
+		predictions[i].chance *= calibration;
+}
+
+/* score the predictors on an open before any of them ( or the graph ) learns from it */
+void Cache_Manager::learn( SystemCall *file )
+{
+	/* only 'open' calls are part of the graph */
+	if( file->callType != "open" )
+		return;
+	Node *node = view->find( file );
+	tournament.score( view->nodes, node ? node->id : -1 );
+	trainer.insert( file );
+	/* a new file is not in the view until the trainer thread publishes it */
+	node = view->find( file );
+	tournament.train( node ? node->id : -1 );
+	static int graph_nodes = metrics.gauge( "graph.nodes" );
+	metrics.set( graph_nodes, view->nodes.size() );
+}
+
+/* a successor seen a few times is held to the pessimistic end of its probability, and the node's */
+/* own record scales it : reliable nodes prefetch more, noisy ones stop filling the buffer */
+double Cache_Manager::confidence( Node *node, int successor )
+{
+	double chance = wilsonLowerBound( node->window[successor].strength, node->total_strength );
+	chance *= feedbackOf( node->id ).calibration();
+	return chance < 1 ? chance : 1;
+}
+
+NodeFeedback& Cache_Manager::feedbackOf( int id )
+{
+	if( id >= (int)feedback.size() )
+		feedback.resize( id + 1 );
+	return feedback[id];
+}
+
+/* informed prefetching ( Patterson et al. ) : the benefit is the stall a prefetch hides, the cost is the hits */
+/* lost by taking its pages from the cache until it is used. all times in microseconds per access */
+bool Cache_Manager::admitPrefetch( double chance, SystemCall *file, int distance )
+{
+	/* only prefetches that would be issued are judged ( and counted, once prefetchFile() issues them ) */
+	if( !needsPrefetch( file ) )
+		return false;
+	long pages = prefetchPages( file );
+	/* it would push its own blocks out of the prefetch buffer ( or the tier it is staged in ) */
+	if( pages > prefetchCapacity() )
+	{
+		prefetches_rejected++;
+		return false;
+	}
+
+	/* the file is needed about distance accesses from now, anything past t_disk is hidden anyway */
+	/* ( a staged prefetch still has to be read from the second tier ) */
+	double lead = distance*( cost_model.cpu + cost_model.hit + cost_model.driver );
+	double stall = cost_model.disk;
+	if( stage_prefetches )
+		stall -= ssd.device.getProfile().latency;
+	double benefit = chance*( lead < stall ? lead : stall );
+
+	/* nothing is displaced while both buffers have room, staging never displaces memory */
+	double cost = 0;
+	if( !stage_prefetches && ( !cache.pages_available || prefetched.pages_available < pages ) )
+	{
+		/* hits per cached page per access, given up for every access until the prefetch is used */
+		double marginal = cache.capacity > 0 ? cache.get_current_hit_ratio()/cache.capacity : 0;
+		cost = pages*marginal*( cost_model.disk - cost_model.hit )*distance;
+	}
+
+	if( benefit > cost )
+		return true;
+	prefetches_rejected++;
+	return false;
+}
+
+void Cache_Manager::setDevice( DeviceProfile profile )
+{
+	disk = Disk_Model( profile );
+}
+
+void Cache_Manager::setSecondTier( long size_in_bytes, DeviceProfile profile, string policy, bool staging )
+{
+	ssd.configure( size_in_bytes/cost_model.block_size, profile, policy );
+	stage_prefetches = staging && ssd.enabled();
+}
+
+void Cache_Manager::trainInBackground()
+{
+	trainer.start();
+}
+
+bool Cache_Manager::loadGraph( string path )
+{
+	return graph->load( path );
+}
+
+bool Cache_Manager::saveGraph( string path )
+{
+	trainer.stop();
+	return graph->save( path );
+}
+
+long Cache_Manager::nodeCount()
+{
+	long count = trainer.acquire()->nodes.size();
+	trainer.release();
+	return count;
+}
+
+void Cache_Manager::setReadGranularity( bool reads )
+{
+	read_granularity = reads;
+}
+
+void Cache_Manager::enableMissRatioCurve( double rate )
+{
+	mrc.enable( rate );
+}
+
+void Cache_Manager::report()
+{
+	cout << "========== Results ==========" << endl;
+	cout << "Cache Hits : " << cache.hit_count << " Misses : " << cache.miss_count << endl;
+	cout << "Prefetch Hits : " << prefetched.hit_count << " Misses : " << prefetched.miss_count << endl;
+	cout << "Prefetches Admitted : " << prefetches_admitted << " Rejected : " << prefetches_rejected << endl;
+	cout << "Grouped Prefetches : " << groups_issued << " ( " << grouped_files << " small files )" << endl;
+	if( read_granularity )
+		cout << "Read Ahead Requests : " << readahead_requests << " ( " << readahead_pages << " pages )" << endl;
+	/* how well the predicting nodes kept their promises */
+	int predictors = 0;
+	double calibration = 0;
+	for( int i = 0; i < feedback.size(); i++ )
+		if( feedback[i].expected > 0 ) {
+			predictors++;
+			calibration += feedback[i].calibration();
+		}
+	if( predictors )
+		cout << "Predicting Nodes : " << predictors << " Mean Calibration : " << calibration/predictors << endl;
+	cout << "Cache Capacity : " << cache.capacity << " Prefetch Capacity : " << prefetched.capacity << " ( pages )" << endl;
+	if( accesses )
+		cout << "Average Access Latency (us) : " << (double)( access_time/accesses*1000000 ) << endl;
+	if( streams.size() > 1 || quotas.size() || fair_share )
+	{
+		cout << "---------- Streams ----------" << endl;
+		for( int i = 0; i < streams.size(); i++ )
+		{
+			StreamStats &stream = streams[i];
+			cout << stream.name << " : cached " << stream.cached << " pages";
+			if( stream.quota )
+				cout << " ( quota " << stream.quota << " )";
+			if( stream.hits + stream.misses )
+				cout << " hit ratio " << (double)stream.hits/( stream.hits + stream.misses );
+			if( stream.prefetch_issued )
+				cout << " prefetches used " << stream.prefetch_hits << "/" << stream.prefetch_issued;
+			cout << endl;
+		}
+	}
+	if( prefetching )
+		tournament.report();
+	/* everything that was queued is learned first */
+	trainer.stop();
+	trainer.report();
+	if( prefetching )
+	{
+		vector<string> names;
+		Probability_Graph *graph = trainer.acquire();
+		for( int i = 0; i < graph->nodes.size(); i++ )
+			names.push_back( graph->nodes[i].call->file );
+		trainer.release();
+		analytics.report( cost_model.block_size, names );
+	}
+	if( ssd.enabled() )
+		ssd.report( cost_model.block_size );
+	disk.report();
+	cost_model.report();
+	if( mrc.enabled() )
+		mrc.report( total_pages, cost_model.block_size );
+	if( series.enabled() )
+	{
+		series.stop();
+		cout << "Time Series Samples : " << series.samples() << " Dropped : " << series.droppedSamples() << endl;
+	}
+}
+
+void Cache_Manager::updateHitRatios( SystemCall *file )
 {
 	/* update the hit ratios every 100 microseconds */
 	Timestamp now;
@@ -671,232 +1766,302 @@ void Cache_Manager::updateHitRatios()
 	{
 		cache.update_hit_ratio();
 		prefetched.update_hit_ratio();
-		clock_one.stamp();
-	}
-
-	/* get data to create a graph every half a second */
-	if(  now.time - clock_two.time > 0.05  )
-	{
-		Timestamp current_time;
-		current_time.stamp();
-		/* get rid of hours and minutes */
-		int hours = current_time.time/3600;
-		current_time.time -= hours*3600;
-		int minutes = current_time.time/60;
-		current_time.time -= minutes*60;
-		ofstream fout;
-		fout.open( "graph_data.txt", ios_base::app );
-		fout << prefetched.get_current_hit_ratio();
-		fout << "\t";
-		fout << prefetched.capacity;
-		fout << "\t";
-		fout << cache.get_current_hit_ratio();
-		fout << "\t";
-		fout << cache.capacity;
-		fout << "\t";
-		fout << current_time.time << endl;
-		fout.close();
-		clock_two.stamp();
+		clock_one = now;
 	}
 
-		
+	/* a sample for the time series every interval of the trace */
+	if( series.due( microseconds( *file ) ) )
+	{
+		TimeSample sample;
+		sample.cache_capacity = cache.capacity;
+		sample.prefetch_capacity = prefetched.capacity;
+		sample.cache_ratio = cache.get_current_hit_ratio();
+		sample.prefetch_ratio = prefetched.get_current_hit_ratio();
+		sample.cache_hits = cache.hit_count;
+		sample.cache_misses = cache.miss_count;
+		sample.prefetch_hits = prefetched.hit_count;
+		sample.prefetch_misses = prefetched.miss_count;
+		sample.prefetches = prefetches_admitted;
+		sample.accesses = accesses;
+		series.record( sample );
+	}
+}
+
+/* write the buffers to a CSV file every interval microseconds of the trace ( see Time_Series.h ) */
+bool Cache_Manager::recordTimeSeries( string path, long long interval )
+{
+	return series.open( path, interval );
 }
 
 
 void Cache_Manager::pipeline(Node* node)
 {
-	cout << "Checking if "<< node->call->file <<" is Pipelinable..." << endl;
+	VERBOSE( cout << "Checking if "<< node->call->file <<" is Pipelinable..." << endl; )
 
 	/* check to make node has associations */
 	if( !node->window.size())
 		return;
 	
 	/******************* STEP 1 : FIND INDICES THAT ARE PROBABLE FOR THE TRIANGULAR MATRIX REPRESENTATIONS ************************/
+	/* the window is sorted strongest first, so runs of equal strength are contiguous */
 	int start, end;
 	for( int i = 0; i < node->window.size() - 1; i++)
 	{
-		start = 0, end = 0;
-		if( node->window[i].strength > 5 )
+		/* nothing past here is strong enough */
+		if( node->window[i].strength <= 5 )
+			break;
+
+		start = i, end = i;
+		int cumulative_strength = node->window[i].strength;
+		for( int j = i + 1; j < node->window.size() && j < i + cost_model.horizon; j++)
+		{	
+			if( node->window[j].strength != node->window[i].strength)
+				break;
+			end++;
+			cumulative_strength += node->window[j].strength; 
+		}
+		/* IF WE HAVE A POSSIBLE PIPELINING OPPORTUNITY */
+		if( end - start + 1 >= cost_model.horizon && ((double)cumulative_strength/node->total_strength) >= 0.5)
 		{
-			start = i, end = i;
-			int cumulative_strength = node->window[i].strength;
-			for( int j = i + 1; j < node->window.size() && j < i + prefetch_horizon; j++)
-			{	
-				if( node->window[j].strength == node->window[i].strength)
-				{
-					end++;
-					cumulative_strength += node->window[j].strength; 
-				}
-			}
-			/* IF WE HAVE A POSSIBLE PIPELINING OPPORTUNITY */
-			if( end - start + 1 >= prefetch_horizon && ((double)cumulative_strength/node->total_strength) >= 0.5)
+			/************************ STEP 2 : CHECK FOR UPPER TRIANGULAR MATRIX FORM *******************************/
+			if( matrix_check(node, start, end ) )
 			{
-				/************************ STEP 2 : CHECK FOR UPPER TRIANGULAR MATRIX FORM *******************************
-				/* do a matrix check */
-				if( matrix_check(node, start, end ) )
+				static int triggers = metrics.counter( "pipeline.triggers" );
+				metrics.add( triggers );
+				/* pipeline prefetch */
+				
+				// start index end index of Node's assoc window //
+				for( int j = start; j <= end; j++ )
 				{
-						/* pipeline prefetch */
-						
-						// start index end index of Node's assoc window //
-						for( int j = start; j <= end; j++ )
-						{
-							cout << "Pipeline prefetching... " << node->window[j].call->file << endl;
-							cout << "File Size : " << node->window[j].call->bytes << endl;
-							//// now go to block level ////
-							for( int k = 0; k < ceil( ((double)(node->window[j].call->bytes)/BLOCK_SIZE) ); k++)
-							{ 
-								/* create an empty page representing a block */
-								Page new_page;
-								new_page.timestamp.stamp();
-								new_page.block_num = k+1;
-								new_page.file = node->window[j].call;
-								/* PREFETCH BLOCK */
-								prefetchAllocate( new_page );
-							}
-						}
-						/* reset variables */
-						i = end;
-						end = 0;
+					VERBOSE( cout << "Pipeline prefetching... " << node->window[j].call->file << endl;
+						cout << "File Size : " << node->window[j].call->bytes << endl; )
+					/* PREFETCH EVERY BLOCK ( the run is accessed in order ) */
+					double chance = confidence( node, j );
+					if( admitPrefetch( chance, node->window[j].call, j - start + 1 ) )
+						prefetchFile( node->window[j].call, node->id, chance, "pipeline " + node->call->file );
 				}
-				/* otherwise just continue to check */					
 			}
-
 		}
+		/* continue to check after this run */
+		i = end;
 	}
 }
 
+/* rows start..end of the Node's window form an upper triangular matrix when every row */
+/* has all of the later rows among its own successors */
 bool Cache_Manager::matrix_check(Node* node, int start, int end)
 {	
-
-	/* create a  string that represents all files in our SystemCall's window */
-	string pipeline_check = "";
-	for( int j = 0; j < node->window.size(); j++)
-		pipeline_check += " " + node->window[j].call->file;
-		
-	/* looking for a decreasing pattern */ 
-	bool triangle_pattern = true;
-	int row_counts[end - start + 1];
-	/* load the array with binary*/
-	int row_index = 0;
-	for( int j = start; j <= end; j++)
-	{
-		row_counts[row_index] = 0;
-		Node *tmp = graph->find( node->window[j].call );
-		if( tmp->window.size() > 0 )
-		{
-			for ( int k = 0; k < tmp->window.size(); k++)
-			{
-				string test = tmp->window[k].call->file;
-								
-				if( pipeline_check.find_first_of( test ) != -1)
-				{
-					/* make sure the association strengths for these two are the same */
-					int strength_l = 0;
-					for( int l = 0; l < node->window.size(); l++) {
-						if( node->window[l].call->file == test ) 
-							strength_l = node->window[l].strength;
-					}
-					int strength_k = tmp->window[k].strength;
-					if( strength_k == strength_l )
-						row_counts[row_index]++;
-				}
-			}
-		}
-		/* check to see if we have broken the triangle pattern */
-		if( row_index > 0 && row_counts[row_index] >= row_counts[row_index-1] )
-		{
-			triangle_pattern = false;
-			break;
-		}
-		row_index++;	
+	/* the ids of the rows below the current one */
+	NodeSet below;
+	for( int j = end; j >= start; j--)
+	{
+		Node &row = view->nodes[ node->window[j].id ];
+		if( row.successors.count_common( below ) != end - j )
+			return false;
+		below.insert( row.id );
 	}
-	
-	return triangle_pattern;
+	return true;
 }
 
+/* marginal utility : a ghost hit is a hit the buffer would have had with more pages, so the pages */
+/* go to the side with more ghost hits. the step halves every time the direction turns around */
 void Cache_Manager::repartitionBuffers()
 {
-	
-	/* find Theta and Delta */
-	double Delta = prefetched.get_current_hit_ratio() - prefetched.get_last_hit_ratio();
-	double Theta = cache.get_current_hit_ratio() - cache.get_last_hit_ratio();
-				
+	if( ++epoch_accesses < REPARTITION_EPOCH )
+		return;
+	epoch_accesses = 0;
+
+	double cache_marginal = (double)cache.ghost_hits/cache.ghost.capacity;
+	double prefetch_marginal = (double)prefetched.ghost_hits/prefetched.ghost.capacity;
+	cache.ghost_hits = 0;
+	prefetched.ghost_hits = 0;
+
+	int direction = 0;
+	if( prefetch_marginal > cache_marginal*( 1 + REPARTITION_TOLERANCE ) )
+		direction = 1;
+	else if( cache_marginal > prefetch_marginal*( 1 + REPARTITION_TOLERANCE ) )
+		direction = -1;
+	/* ELSE DO NOTHING */
+	if( !direction )
+		return;
 
-	/* Theta and Delta are not moving significantly -> reset to optimal values */
-	if ( Delta > -DOUBLE_ZERO && Delta < DOUBLE_ZERO && Theta > -DOUBLE_ZERO && Theta < DOUBLE_ZERO) {
-			
-		int new_size =  (double)((double)( assoc_count / graph->nodes.size() )*prefetch_horizon )*prefetched.get_current_hit_ratio();
-		if( new_size < (0.1)*(total_pages) && new_size > prefetch_horizon  ) 
-	 		prefetched.capacity = new_size;
-		else 
-			prefetched.capacity = (0.1)*(total_pages);
-			
-		if( prefetched.capacity > prefetched.buffer.size() )
-			prefetched.pages_available = prefetched.capacity - prefetched.buffer.size();
-		else
-		{
-			prefetched.pages_available = 0;
-			/* remove excesss pages that now belong to cache */
-			while( prefetched.buffer.size() > prefetched.capacity) {
-				set<Page>::iterator it = prefetched.buffer.begin();
-				prefetched.buffer.erase( it );	
-			}
-			
-		} 
-		/* also change the cache buffer size to accomodate any empty space */
-		cache.capacity = total_pages - prefetched.capacity;
-		if( cache.capacity > cache.buffer.size() )
-			cache.pages_available = cache.capacity - cache.buffer.size();
-		else
-		{
-			/* remove excess pages that now belong to prefetch buffer */
-			cache.pages_available = 0;
-			while( prefetched.buffer.size() > prefetched.capacity) {
-				set<Page>::iterator it = cache.buffer.begin();
-				cache.buffer.erase( it );	
-			} 
-		}	
-	}
-	else if( Delta < Theta )  {
-		if(prefetched.capacity > prefetch_horizon)
+	/* smaller steps around the balance point, larger ones again once it has moved away */
+	if( direction == -repartition_direction )
+	{
+		if( repartition_step > 1 )
+			repartition_step /= 2;
+		repartition_moves = 0;
+	}
+	else if( ++repartition_moves >= REPARTITION_REGROW && repartition_step < repartition_initial )
+	{
+		repartition_step = min( repartition_step*2, repartition_initial );
+		repartition_moves = 0;
+	}
+	repartition_direction = direction;
+	resizeBuffers( prefetched.capacity + direction*repartition_step );
+}
+
+void Cache_Manager::resizeBuffers( long capacity )
+{
+	/* the prefetch buffer keeps room for a full pipeline and never takes more than half the memory */
+	if( capacity > total_pages/2 )
+		capacity = total_pages/2;
+	if( capacity < cost_model.horizon )
+		capacity = cost_model.horizon;
+
+	prefetched.capacity = capacity;
+	while( (long)prefetched.buffer.size() > prefetched.capacity )
+		evictPrefetch();
+	prefetched.pages_available = prefetched.capacity - prefetched.buffer.size();
+
+	cache.capacity = total_pages - prefetched.capacity;
+	while( (long)cache.buffer.size() > cache.capacity )
+		evictCache( DISPLACED_BY_GROWTH );
+	cache.pages_available = cache.capacity - cache.buffer.size();
+}
+
+void Cache_Manager::evictCache( int displacer )
+{
+	if( cache.buffer.empty() )
+		return;
+	set<Page>::iterator it = cache.buffer.begin();
+	/* the least recently used page of the stream over its share */
+	int victim = victimStream();
+	if( victim >= 0 && cache.oldest( victim ) != cache.buffer.end() )
+		it = cache.oldest( victim );
+	streams[(*it).owner].cached--;
+	cache.ghost.insert( *it );
+	analytics.evicted( PrefetchAnalytics::Key( (*it).file->file, (*it).block_num ), displacer );
+	static int evictions = metrics.counter( "cache.evictions" );
+	metrics.add( evictions );
+	cache.erase( it );
+}
+
+/* an expired page is not remembered by the ghost list : a larger buffer would have dropped it too */
+void Cache_Manager::evictPrefetch( int displacer, bool expired )
+{
+	if( prefetched.buffer.empty() )
+		return;
+	set<Page>::iterator it = prefetched.buffer.begin();
+	streams[(*it).owner].prefetched--;
+	if( !expired )
+		prefetched.ghost.insert( *it );
+	analytics.evicted( PrefetchAnalytics::Key( (*it).file->file, (*it).block_num ), displacer );
+	static int evictions = metrics.counter( "prefetch.evictions" );
+	metrics.add( evictions );
+	prefetched.erase( it );
+}
+
+pair<bool, Page> Cache_Manager::cacheInsert( Page page )
+{
+	/* a stream at its quota makes room among its own pages even while the cache has free ones */
+	StreamStats &stream = streams[page.owner];
+	if( stream.quota && stream.cached >= stream.quota && !cache.isCached( page ) )
+	{
+		evictCache();
+		cache.pages_available++;
+	}
+	pair<bool, Page> result = cache.insert( page );
+	if( result.first )
+		streams[page.owner].cached++;
+	return result;
+}
+
+pair<bool, Page> Cache_Manager::prefetchInsert( Page page )
+{
+	pair<bool, Page> result = prefetched.insert( page );
+	if( result.first )
+	{
+		analytics.issued( PrefetchAnalytics::Key( page.file->file, page.block_num ), page.source, page.ready.time );
+		streams[page.owner].prefetched++;
+		streams[page.owner].prefetch_issued++;
+	}
+	return result;
+}
+
+void Cache_Manager::tierInsert( SystemCall *file, int block, long double ready, int source )
+{
+	vector<Storage_Tier::Key> dropped;
+	if( ssd.insert( Storage_Tier::Key( file->file, block ), ready, source, &dropped ) && source >= 0 )
+		analytics.issued( PrefetchAnalytics::Key( file->file, block ), source, ready );
+	/* staged prefetches the tier lost before they were read, nothing in memory was displaced */
+	for( int i = 0; i < dropped.size(); i++ )
+		analytics.evicted( dropped[i], NOT_DISPLACED );
+}
+
+void Cache_Manager::setStreamPolicy( map<string, long> stream_quotas, map<string, double> stream_weights, bool fair )
+{
+	quotas = stream_quotas;
+	weights = stream_weights;
+	fair_share = fair;
+	/* only then is a victim chosen by stream */
+	if( quotas.size() || fair_share )
+		cache.trackOwners();
+}
+
+void Cache_Manager::countAccess( int hits, int misses, int prefetch_hits, int prefetch_misses )
+{
+	streams[current_stream].hits += cache.hit_count - hits;
+	streams[current_stream].misses += cache.miss_count - misses;
+	static int cache_hits = metrics.counter( "cache.hits" ), cache_misses = metrics.counter( "cache.misses" );
+	static int prefetched_hits = metrics.counter( "prefetch.hits" ), prefetched_misses = metrics.counter( "prefetch.misses" );
+	metrics.add( cache_hits, cache.hit_count - hits );
+	metrics.add( cache_misses, cache.miss_count - misses );
+	metrics.add( prefetched_hits, prefetched.hit_count - prefetch_hits );
+	metrics.add( prefetched_misses, prefetched.miss_count - prefetch_misses );
+}
+
+/* a program in a SEER or capture trace, a pid in an strace -f trace, else one stream for everything */
+int Cache_Manager::streamOf( SystemCall *call )
+{
+	string name = "all";
+	if( call->program != "" )
+		name = call->program;
+	else if( call->pid )
+	{
+		ostringstream pid;
+		pid << "pid " << call->pid;
+		name = pid.str();
+	}
+	map<string, int>::iterator it = stream_index.find( name );
+	if( it != stream_index.end() )
+		return it->second;
+
+	StreamStats stream;
+	stream.name = name;
+	if( quotas.count( name ) )
+		stream.quota = quotas[name];
+	if( weights.count( name ) && weights[name] > 0 )
+		stream.weight = weights[name];
+	streams.push_back( stream );
+	stream_index[name] = streams.size() - 1;
+	return streams.size() - 1;
+}
+
+int Cache_Manager::victimStream()
+{
+	/* a stream at its quota replaces its own pages, one over it gives them up first */
+	if( streams[current_stream].quota && streams[current_stream].cached >= streams[current_stream].quota )
+		return current_stream;
+	for( int i = 0; i < streams.size(); i++ )
+		if( streams[i].quota && streams[i].cached > streams[i].quota )
+			return i;
+	if( !fair_share )
+		return -1;
+
+	/* weighted fair share : the stream holding the most pages per unit of weight */
+	int victim = -1;
+	double most = 0;
+	for( int i = 0; i < streams.size(); i++ )
+	{
+		double share = streams[i].cached/streams[i].weight;
+		if( share > most )
 		{
-			prefetched.capacity--;
-			if ( prefetched.pages_available )
-				prefetched.pages_available--;
-			else {
-				set<Page>::iterator iter = prefetched.buffer.begin();
-				prefetched.buffer.erase( iter );
-			}
-			cache.capacity++;
-			cache.pages_available++;
+			most = share;
+			victim = i;
 		}
-		if( minimum_chance  < 0.9)
-			minimum_chance += 0.1;				
 	}
-	else if( Delta > Theta ) {
-		if( prefetched.capacity <= (0.1)*(total_pages) )
-		{
-			prefetched.capacity++;
-			prefetched.pages_available++;
-			cache.capacity--;
-			if( cache.pages_available )
-				cache.pages_available--;
-			else {
-				set<Page>::iterator iter = cache.buffer.begin();
-				cache.buffer.erase( iter );
-			}
-		}	
-		if( minimum_chance  > 0.3)
-			minimum_chance -= 0.1;		
-
-	}	
-	/* ELSE DO NOTHING  */
-	
-	if( Delta > 0 && minimum_chance < 0.9)
-		minimum_chance +=0.1;
-	else if( Delta < 0 && minimum_chance > 0.3 )
-		minimum_chance -=0.1;
-	
+	return victim;
 }
 
 void Cache_Manager::cacheToString()
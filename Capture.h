@@ -0,0 +1,35 @@
+/* record format shared by the preloaded capture shim ( Capture_Shim.cpp ) and the simulator's CaptureReceiver */
+/* records are packed back to back in datagrams of at most CAPTURE_BATCH_BYTES */
+#ifndef Capture_H
+#define Capture_H
+
+#define CAPTURE_SOCKET "/tmp/hpp_capture.sock" // overridden by the HPP_CAPTURE_SOCKET environment variable
+#define CAPTURE_BATCH_BYTES 16384 // bytes per datagram
+#define CAPTURE_FLUSH_NS 10000000 // a batch is sent once its first record is this old ( 10 ms )
+/* a record reaches the simulator at most this long after its time ( the flush thread wakes every CAPTURE_FLUSH_NS ), */
+/* so the receiver holds each one that long to put the records of every thread and process back in time order */
+#define CAPTURE_REORDER_NS ( 2*CAPTURE_FLUSH_NS )
+#define CAPTURE_PATH_MAX 4095 // longer paths are truncated
+
+/* record types */
+#define CAPTURE_OPEN 1 // an open/openat/fopen call, relative paths are made absolute by the shim
+#define CAPTURE_START 2 // the process started ( sent right away, before it can fork ), the path is the program name
+#define CAPTURE_EXIT 3 // the process exited
+#define CAPTURE_DROPPED 4 // result holds the number of records the shim could not send
+
+struct CaptureRecord
+{
+	unsigned long long time; // nanoseconds on CLOCK_MONOTONIC
+	int pid;
+	int result; // file descriptor returned, -1 on failure
+	unsigned short type;
+	unsigned short length; // bytes of path that follow the record ( not NUL terminated )
+};
+
+/* records ( and their paths ) start on 8 byte boundaries */
+inline int captureRecordSize( int length )
+{
+	return ( sizeof(CaptureRecord) + length + 7 ) & ~7;
+}
+
+#endif
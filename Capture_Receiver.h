@@ -0,0 +1,253 @@
+/* receives the records sent by the capture shim ( Capture_Shim.cpp ) and turns them into SystemCalls */
+#ifndef Capture_Receiver_H
+#define Capture_Receiver_H
+
+#include <string>
+#include <set>
+#include <map>
+#include <queue>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include "Driver.h"
+#include "Capture.h"
+
+using namespace std;
+
+class CaptureReceiver
+{
+
+	private :
+	/* a record held until no older one can arrive */
+	struct Pending
+	{
+		unsigned long long time;
+		long sequence; // arrival order of records with the same time
+		int pid, result;
+		unsigned short type;
+		string file, program;
+
+		bool operator<( const Pending &other ) const
+		{
+			if( time != other.time )
+				return time > other.time; // the oldest is the top of the queue
+			return sequence > other.sequence;
+		}
+	};
+	priority_queue<Pending> pending;
+	long sequence;
+	bool closing; // every process exited ( or the socket failed ), what is held is released now
+	unsigned long long last_check; // of the processes that are still alive
+
+	string path;
+	int sock;
+	char buffer[CAPTURE_BATCH_BYTES];
+	int length, position;
+	/* processes that have sent records and not exited */
+	set<int> active;
+	/* program name of each process, from its start record or read once while it is alive */
+	map<int, string> programs;
+	string programOf(int);
+	static unsigned long long now();
+
+	public :
+	long dropped; // records the shims could not send
+	CaptureReceiver(string);
+	~CaptureReceiver();
+
+	/* wait for the next open ( false once every process that started has exited ) */
+	bool receive(SystemCall&);
+};
+
+CaptureReceiver::CaptureReceiver(string socket_path)
+{
+	path = socket_path;
+	length = 0;
+	position = 0;
+	dropped = 0;
+	sequence = 0;
+	closing = false;
+	last_check = now();
+
+	struct sockaddr_un address;
+	memset( &address, 0, sizeof(address) );
+	address.sun_family = AF_UNIX;
+	strncpy( address.sun_path, path.c_str(), sizeof(address.sun_path) - 1 );
+	unlink( path.c_str() );
+	sock = socket( AF_UNIX, SOCK_DGRAM, 0 );
+	if( sock < 0 || bind( sock, (struct sockaddr *)&address, sizeof(address) ) < 0 )
+	{
+		cout << "Error: cannot listen on " << path << endl;
+		if( sock >= 0 )
+			close( sock );
+		sock = -1;
+		return;
+	}
+	/* room for bursts while the simulator is busy */
+	int size = 8*1024*1024;
+	setsockopt( sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size) );
+	/* wake up to release the held records, and every second look for processes that exited without saying so ( _exit, signals ) */
+	timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = CAPTURE_FLUSH_NS/1000;
+	setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+}
+
+CaptureReceiver::~CaptureReceiver()
+{
+	if( sock >= 0 )
+	{
+		close( sock );
+		unlink( path.c_str() );
+	}
+}
+
+string CaptureReceiver::programOf(int pid)
+{
+	map<int, string>::iterator it = programs.find( pid );
+	if( it != programs.end() )
+		return it->second;
+	string name;
+	char comm_path[64];
+	snprintf( comm_path, sizeof(comm_path), "/proc/%d/comm", pid );
+	ifstream comm( comm_path );
+	getline( comm, name );
+	programs[pid] = name;
+	return name;
+}
+
+/* the same clock as the shim */
+unsigned long long CaptureReceiver::now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+bool CaptureReceiver::receive(SystemCall &call)
+{
+	while( true )
+	{
+		/* release the oldest record once every record older than it has arrived */
+		if( !pending.empty() && ( closing || pending.top().time + CAPTURE_REORDER_NS <= now() ) )
+		{
+			Pending record = pending.top();
+			pending.pop();
+			if( record.type == CAPTURE_EXIT )
+			{
+				if( active.erase( record.pid ) && active.empty() )
+					closing = true;
+				continue;
+			}
+
+			call.callType = "open";
+			call.file = record.file;
+			call.streamID = record.result;
+			call.pid = record.pid;
+			call.program = record.program;
+
+			/* get total size in bytes */
+			struct stat buff;
+			if( stat( call.file.c_str(), &buff ) == 0 )
+				call.bytes = buff.st_size;
+			else
+				call.bytes = 512;
+			call.offset = 0;
+
+			/* the monotonic clock only has to be consistent between processes, so use it as the time of day */
+			unsigned long long micro = record.time/1000;
+			long seconds = ( micro/1000000 ) % 86400;
+			call.hourTime = seconds/3600;
+			call.minuteTime = ( seconds/60 ) % 60;
+			call.secondTime = seconds % 60;
+			call.microSecondTime = micro % 1000000;
+			return true;
+		}
+		if( closing || sock < 0 )
+			return false;
+
+		/* get the next batch */
+		if( position >= length )
+		{
+			length = recv( sock, buffer, sizeof(buffer), 0 );
+			position = 0;
+			if( length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+				closing = true;
+			else if( length < 0 && !active.empty() && now() - last_check >= 1000000000ULL )
+			{
+				last_check = now();
+				for( set<int>::iterator it = active.begin(); it != active.end(); )
+				{
+					if( kill( *it, 0 ) < 0 && errno == ESRCH )
+						active.erase( it++ );
+					else
+						it++;
+				}
+				if( active.empty() )
+					closing = true;
+			}
+			continue;
+		}
+
+		/* a record ( or its path ) that runs past the end of the datagram : the rest of the batch cannot be trusted */
+		CaptureRecord header;
+		if( position + (int)sizeof(header) > length )
+		{
+			position = length;
+			continue;
+		}
+		memcpy( &header, buffer + position, sizeof(header) );
+		if( position + captureRecordSize( header.length ) > length )
+		{
+			position = length;
+			continue;
+		}
+		const char *record_path = buffer + position + sizeof(header);
+		position += captureRecordSize( header.length );
+
+		if( header.type == CAPTURE_START )
+		{
+			active.insert( header.pid );
+			if( header.length )
+				programs[header.pid].assign( record_path, header.length );
+			else
+			{
+				/* a shim that does not send the name, read it while the process is alive */
+				programs.erase( header.pid );
+				programOf( header.pid );
+			}
+			continue;
+		}
+		if( header.type == CAPTURE_DROPPED )
+		{
+			dropped += header.result;
+			continue;
+		}
+		/* opens, and exits after the opens before them */
+		Pending record;
+		record.time = header.time;
+		record.sequence = sequence++;
+		record.pid = header.pid;
+		record.result = header.result;
+		record.type = header.type;
+		record.file.assign( record_path, header.length );
+		/* by the time the record is released the process may be gone */
+		record.program = programOf( header.pid );
+		/* the exit comes after every record of the process, and its pid can be used again */
+		if( header.type == CAPTURE_EXIT )
+			programs.erase( header.pid );
+		pending.push( record );
+	}
+}
+
+#endif
@@ -0,0 +1,410 @@
+/* Preloadable capture shim : records every open with a monotonic timestamp and sends batches of them to the simulator */
+/* Build :   g++ -O2 -shared -fPIC -o capture_shim.so Capture_Shim.cpp -ldl -lpthread */
+/* Run :     ./Driver - [args] --capture   and then   LD_PRELOAD=./capture_shim.so ./app */
+/* Each open costs a clock read and a copy into a per-thread buffer, the system call to send happens once per batch */
+/* ( a background thread sends the batches of threads that stopped opening files, so no record waits much longer ) */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Capture.h"
+
+/* a batch of records waiting to be sent */
+struct CaptureBatch
+{
+	char data[CAPTURE_BATCH_BYTES];
+	int length;
+	unsigned long long first_time;
+	pthread_mutex_t lock; // the owning thread and the flush thread
+	CaptureBatch *next, *previous; // every thread's batch
+};
+
+/* the real functions */
+static int (*real_open)(const char*, int, ...);
+static int (*real_open64)(const char*, int, ...);
+static int (*real_openat)(int, const char*, int, ...);
+static int (*real_openat64)(int, const char*, int, ...);
+static FILE* (*real_fopen)(const char*, const char*);
+static FILE* (*real_fopen64)(const char*, const char*);
+
+static int capture_socket = -1;
+static int capture_pid = 0; // getpid() is a system call, so it is cached
+static pthread_key_t batch_key;
+static unsigned long dropped = 0;
+/* the batches of every thread, for the flush thread */
+static CaptureBatch *batches = NULL;
+static pthread_mutex_t batches_lock = PTHREAD_MUTEX_INITIALIZER;
+static int flusher_pid = 0; // the process the flush thread runs in
+
+static __thread CaptureBatch *batch = NULL;
+static __thread int busy = 0; // set while the shim itself is running
+
+static unsigned long long now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* send the batch, drop it if the simulator is not keeping up */
+static void flush( CaptureBatch *b )
+{
+	if( b->length == 0 )
+		return;
+	if( capture_socket < 0 || send( capture_socket, b->data, b->length, MSG_DONTWAIT ) < 0 )
+	{
+		int count = 0;
+		for( int i = 0; i < b->length; i += captureRecordSize( ((CaptureRecord *)(b->data + i))->length ) )
+			count++;
+		__sync_fetch_and_add( &dropped, count );
+	}
+	b->length = 0;
+}
+
+/* every CAPTURE_FLUSH_NS, send the batches whose first record is that old */
+static void* flusher( void* )
+{
+	busy = 1;
+	struct timespec period;
+	period.tv_sec = 0;
+	period.tv_nsec = CAPTURE_FLUSH_NS;
+	while( true )
+	{
+		nanosleep( &period, NULL );
+		unsigned long long time = now();
+		pthread_mutex_lock( &batches_lock );
+		for( CaptureBatch *b = batches; b != NULL; b = b->next )
+		{
+			pthread_mutex_lock( &b->lock );
+			if( b->length && time - b->first_time >= CAPTURE_FLUSH_NS )
+				flush( b );
+			pthread_mutex_unlock( &b->lock );
+		}
+		pthread_mutex_unlock( &batches_lock );
+	}
+	return NULL;
+}
+
+/* ( again in a child after a fork ) the thread takes no signals meant for the program */
+static void start_flusher()
+{
+	flusher_pid = capture_pid;
+	sigset_t all, old;
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &old );
+	pthread_t thread;
+	if( pthread_create( &thread, NULL, flusher, NULL ) == 0 )
+		pthread_detach( thread );
+	pthread_sigmask( SIG_SETMASK, &old, NULL );
+}
+
+/* drop the . and .. parts and repeated slashes of an absolute path, in place */
+static void normalize( char *path )
+{
+	char *out = path;
+	const char *in = path;
+	while( *in )
+	{
+		while( *in == '/' )
+			in++;
+		const char *end = in;
+		while( *end && *end != '/' )
+			end++;
+		int part = end - in;
+		if( part == 0 || ( part == 1 && in[0] == '.' ) )
+			;
+		else if( part == 2 && in[0] == '.' && in[1] == '.' )
+		{
+			while( out > path && *--out != '/' )
+				;
+		}
+		else
+		{
+			*out++ = '/';
+			memmove( out, in, part );
+			out += part;
+		}
+		in = end;
+	}
+	if( out == path )
+		*out++ = '/';
+	*out = 0;
+}
+
+/* a relative path is relative to dirfd, or the working directory for AT_FDCWD */
+static const char* absolute( int dirfd, const char *path, char *resolved )
+{
+	if( path == NULL || path[0] == '/' )
+		return path;
+	int length;
+	if( dirfd == AT_FDCWD )
+		length = getcwd( resolved, CAPTURE_PATH_MAX + 1 ) ? strlen( resolved ) : -1;
+	else
+	{
+		char link[64];
+		snprintf( link, sizeof(link), "/proc/self/fd/%d", dirfd );
+		length = readlink( link, resolved, CAPTURE_PATH_MAX );
+	}
+	if( length <= 0 || resolved[0] != '/' )
+		return path;
+	snprintf( resolved + length, CAPTURE_PATH_MAX + 1 - length, "/%s", path );
+	normalize( resolved );
+	return resolved;
+}
+
+/* append a record to this thread's batch. the caller sees the errno of its own call, not of the send or calloc here */
+static void capture( unsigned short type, const char *path, int result, int dirfd = AT_FDCWD )
+{
+	if( busy || capture_socket < 0 )
+		return;
+	busy = 1;
+	int saved_errno = errno;
+
+	unsigned long long time = now();
+	if( flusher_pid != capture_pid )
+		start_flusher();
+	if( batch == NULL )
+	{
+		batch = (CaptureBatch *)calloc( 1, sizeof(CaptureBatch) );
+		pthread_mutex_init( &batch->lock, NULL );
+		pthread_setspecific( batch_key, batch );
+		pthread_mutex_lock( &batches_lock );
+		batch->next = batches;
+		if( batches != NULL )
+			batches->previous = batch;
+		batches = batch;
+		pthread_mutex_unlock( &batches_lock );
+	}
+
+	/* the path of an open, the program name of a start */
+	char resolved[CAPTURE_PATH_MAX + 1];
+	if( type == CAPTURE_OPEN )
+		path = absolute( dirfd, path, resolved );
+	int length = path ? strnlen( path, CAPTURE_PATH_MAX ) : 0;
+	int size = captureRecordSize( length );
+	pthread_mutex_lock( &batch->lock );
+	if( batch->length + size > CAPTURE_BATCH_BYTES || ( batch->length && time - batch->first_time > CAPTURE_FLUSH_NS ) )
+		flush( batch );
+	if( batch->length == 0 )
+		batch->first_time = time;
+
+	CaptureRecord *record = (CaptureRecord *)( batch->data + batch->length );
+	record->time = time;
+	record->pid = capture_pid;
+	record->result = result;
+	record->type = type;
+	record->length = length;
+	memcpy( record + 1, path, length );
+	batch->length += size;
+	pthread_mutex_unlock( &batch->lock );
+
+	errno = saved_errno;
+	busy = 0;
+}
+
+/* flush whatever a thread still has when it exits */
+static void thread_exit( void *data )
+{
+	int saved_errno = errno;
+	CaptureBatch *b = (CaptureBatch *)data;
+	pthread_mutex_lock( &batches_lock );
+	if( b->previous != NULL )
+		b->previous->next = b->next;
+	else
+		batches = b->next;
+	if( b->next != NULL )
+		b->next->previous = b->previous;
+	pthread_mutex_unlock( &batches_lock );
+	flush( b );
+	pthread_mutex_destroy( &b->lock );
+	free( b );
+	errno = saved_errno;
+}
+
+/* no batch is being flushed while the process forks */
+static void before_fork()
+{
+	pthread_mutex_lock( &batches_lock );
+}
+static void after_fork_parent()
+{
+	pthread_mutex_unlock( &batches_lock );
+}
+
+/* the child starts with a copy of the parent's unsent records, which the parent will send. only the */
+/* forking thread lives on, the other batches are gone and the child starts its own flush thread */
+static void after_fork()
+{
+	capture_pid = getpid();
+	for( CaptureBatch *b = batches, *next; b != NULL; b = next )
+	{
+		next = b->next;
+		if( b != batch )
+			free( b );
+	}
+	batches = batch;
+	if( batch != NULL )
+	{
+		pthread_mutex_init( &batch->lock, NULL );
+		batch->length = 0;
+		batch->next = NULL;
+		batch->previous = NULL;
+	}
+	pthread_mutex_init( &batches_lock, NULL );
+}
+
+/* look up the real functions ( opens can happen before our constructor runs ) */
+static void resolve()
+{
+	real_open = (int (*)(const char*, int, ...))dlsym( RTLD_NEXT, "open" );
+	real_open64 = (int (*)(const char*, int, ...))dlsym( RTLD_NEXT, "open64" );
+	real_openat = (int (*)(int, const char*, int, ...))dlsym( RTLD_NEXT, "openat" );
+	real_openat64 = (int (*)(int, const char*, int, ...))dlsym( RTLD_NEXT, "openat64" );
+	real_fopen = (FILE* (*)(const char*, const char*))dlsym( RTLD_NEXT, "fopen" );
+	real_fopen64 = (FILE* (*)(const char*, const char*))dlsym( RTLD_NEXT, "fopen64" );
+}
+
+__attribute__((constructor)) static void capture_init()
+{
+	busy = 1;
+	if( real_open == NULL )
+		resolve();
+	capture_pid = getpid();
+	pthread_key_create( &batch_key, thread_exit );
+	pthread_atfork( before_fork, after_fork_parent, after_fork );
+
+	/* connect to the simulator, if it is not there the records are dropped */
+	const char *path = getenv( "HPP_CAPTURE_SOCKET" );
+	if( path == NULL )
+		path = CAPTURE_SOCKET;
+	struct sockaddr_un address;
+	memset( &address, 0, sizeof(address) );
+	address.sun_family = AF_UNIX;
+	strncpy( address.sun_path, path, sizeof(address.sun_path) - 1 );
+	capture_socket = socket( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+	if( capture_socket >= 0 && connect( capture_socket, (struct sockaddr *)&address, sizeof(address) ) < 0 )
+	{
+		close( capture_socket );
+		capture_socket = -1;
+	}
+	busy = 0;
+
+	/* register with the simulator before any child can, with the name the program was started with */
+	capture( CAPTURE_START, program_invocation_short_name, 0 );
+	if( batch != NULL )
+	{
+		pthread_mutex_lock( &batch->lock );
+		flush( batch );
+		pthread_mutex_unlock( &batch->lock );
+	}
+}
+
+__attribute__((destructor)) static void capture_fini()
+{
+	/* the other threads' records go before the exit record */
+	pthread_mutex_lock( &batches_lock );
+	for( CaptureBatch *b = batches; b != NULL; b = b->next )
+	{
+		pthread_mutex_lock( &b->lock );
+		if( b != batch )
+			flush( b );
+		pthread_mutex_unlock( &b->lock );
+	}
+	pthread_mutex_unlock( &batches_lock );
+	if( dropped )
+		capture( CAPTURE_DROPPED, NULL, dropped );
+	capture( CAPTURE_EXIT, NULL, 0 );
+	if( batch != NULL )
+	{
+		pthread_mutex_lock( &batch->lock );
+		flush( batch );
+		pthread_mutex_unlock( &batch->lock );
+	}
+}
+
+/* open takes a mode only when it can create the file */
+#define OPEN_MODE( flags, mode ) \
+	if( (flags) & ( O_CREAT | O_TMPFILE ) ) \
+	{ \
+		va_list args; \
+		va_start( args, flags ); \
+		mode = va_arg( args, int ); \
+		va_end( args ); \
+	}
+
+extern "C" int open( const char *path, int flags, ... )
+{
+	if( real_open == NULL )
+		resolve();
+	int mode = 0;
+	OPEN_MODE( flags, mode );
+	int fd = real_open( path, flags, mode );
+	capture( CAPTURE_OPEN, path, fd );
+	return fd;
+}
+
+extern "C" int open64( const char *path, int flags, ... )
+{
+	if( real_open == NULL )
+		resolve();
+	int mode = 0;
+	OPEN_MODE( flags, mode );
+	int fd = real_open64( path, flags, mode );
+	capture( CAPTURE_OPEN, path, fd );
+	return fd;
+}
+
+extern "C" int openat( int dirfd, const char *path, int flags, ... )
+{
+	if( real_open == NULL )
+		resolve();
+	int mode = 0;
+	OPEN_MODE( flags, mode );
+	int fd = real_openat( dirfd, path, flags, mode );
+	capture( CAPTURE_OPEN, path, fd, dirfd );
+	return fd;
+}
+
+extern "C" int openat64( int dirfd, const char *path, int flags, ... )
+{
+	if( real_open == NULL )
+		resolve();
+	int mode = 0;
+	OPEN_MODE( flags, mode );
+	int fd = real_openat64( dirfd, path, flags, mode );
+	capture( CAPTURE_OPEN, path, fd, dirfd );
+	return fd;
+}
+
+extern "C" FILE* fopen( const char *path, const char *mode )
+{
+	if( real_open == NULL )
+		resolve();
+	FILE *file = real_fopen( path, mode );
+	capture( CAPTURE_OPEN, path, file ? fileno( file ) : -1 );
+	return file;
+}
+
+extern "C" FILE* fopen64( const char *path, const char *mode )
+{
+	if( real_open == NULL )
+		resolve();
+	FILE *file = real_fopen64( path, mode );
+	capture( CAPTURE_OPEN, path, file ? fileno( file ) : -1 );
+	return file;
+}
@@ -0,0 +1,130 @@
+/* timing model used by the Cache_Manager for its cost/benefit decisions */
+/* loaded at startup from a file ( key = value lines, # comments ) or --key=value options */
+#ifndef Cost_Model_H
+#define Cost_Model_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/* inter-access gaps longer than this are idle time, not CPU time ( microseconds ) */
+#define COST_MODEL_IDLE_GAP 1000000
+
+struct CostModel
+{
+	/* define all times in microseconds */
+	double disk; // Samsung Serial ATA 320 gb 16mb of DRAM as a buffer ( 8.9 ms delay )
+	double cpu; // inter-access CPU time of application ( 1000 system calls per second average )
+	double hit; // time to read a several kilobytes from cache
+	double driver; // time to allocate new pages
+	double gamma; // for the weighted moving cache and prefetch hit ratio
+	long block_size; // bytes
+	bool disk_given; // t_disk was set ( by the file or an option ), not left to the device
+
+	/* online estimate of cpu from the trace ( exponentially weighted ) */
+	bool adaptive;
+	double alpha;
+	long long last_access; // microseconds, -1 before the first access
+
+	/* derived in microseconds */
+	int horizon; // number of simultaneous prefetches to pipeline
+	double ttl; // how long a prefetched page is kept without being used
+
+	CostModel()
+	{
+		disk = 8900;
+		cpu = 100;
+		hit = 50;
+		driver = 500;
+		gamma = 0.50;
+		block_size = 512;
+		disk_given = false;
+		adaptive = true;
+		alpha = 0.05;
+		last_access = -1;
+		derive();
+	}
+
+	void derive()
+	{
+		horizon = (int)floor( disk/( cpu + hit + driver ) + 0.5 );
+		if( horizon < 1 )
+			horizon = 1;
+		ttl = disk + cpu;
+	}
+
+	/* set one parameter, false if the key is not part of the model */
+	bool set( string key, string value )
+	{
+		double number = atof( value.c_str() );
+		if( key == "t_disk" ) { disk = number; disk_given = true; }
+		else if( key == "t_cpu" ) cpu = number;
+		else if( key == "t_hit" ) hit = number;
+		else if( key == "t_driver" ) driver = number;
+		else if( key == "gamma" ) gamma = number;
+		else if( key == "block_size" ) block_size = (long)number;
+		else if( key == "cpu_alpha" ) alpha = number;
+		else if( key == "adaptive" ) adaptive = ( value == "true" || value == "1" );
+		else
+			return false;
+		derive();
+		return true;
+	}
+
+	bool load( string path )
+	{
+		ifstream in( path.c_str() );
+		if( !in )
+			return false;
+		string line;
+		while( getline( in, line ) )
+		{
+			line = line.substr( 0, line.find( '#' ) );
+			size_t equals = line.find( '=' );
+			if( equals == string::npos )
+				continue;
+			string key = trim( line.substr( 0, equals ) );
+			string value = trim( line.substr( equals + 1 ) );
+			if( !set( key, value ) )
+				cout << "Warning: unknown cost model parameter " << key << endl;
+		}
+		return true;
+	}
+
+	/* an access at time ( microseconds ) in the trace : track the gap between accesses */
+	void observe( long long time )
+	{
+		if( !adaptive )
+			return;
+		long long gap = time - last_access;
+		if( last_access >= 0 && gap >= 0 && gap < COST_MODEL_IDLE_GAP )
+		{
+			cpu = ( 1 - alpha )*cpu + alpha*gap;
+			derive();
+		}
+		last_access = time;
+	}
+
+	void report()
+	{
+		cout << "---------- Cost Model ----------" << endl;
+		cout << "t_disk : " << disk << " t_cpu : " << cpu << " t_hit : " << hit << " t_driver : " << driver << endl;
+		cout << "Prefetch Horizon : " << horizon << " Prefetch TTL (us) : " << ttl << endl;
+	}
+
+	static string trim( string s )
+	{
+		size_t first = s.find_first_not_of( " \t\r" );
+		if( first == string::npos )
+			return "";
+		return s.substr( first, s.find_last_not_of( " \t\r" ) - first + 1 );
+	}
+};
+
+CostModel cost_model;
+
+#endif
@@ -0,0 +1,194 @@
+/* discrete-event model of the device behind the cache : queue depth, per-request latency and shared bandwidth */
+/* times are in seconds ( like Timestamp ), device parameters in microseconds and bytes */
+#ifndef Disk_Model_H
+#define Disk_Model_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+
+using namespace std;
+
+struct DeviceProfile
+{
+	string name;
+	double latency; // microseconds of seek / command latency per request
+	double bandwidth; // bytes per microsecond ( 0 : transfers take no time )
+	int queue_depth; // requests serviced at once ( 0 : unlimited )
+};
+
+/* fixed : every request takes latency microseconds no matter what else is in flight ( the original model ) */
+DeviceProfile deviceProfile( string name, double fixed_latency )
+{
+	DeviceProfile profile;
+	profile.name = name;
+	if( name == "hdd" ) { // 7200 rpm SATA disk, one head
+		profile.latency = fixed_latency;
+		profile.bandwidth = 100;
+		profile.queue_depth = 1;
+	}
+	else if( name == "ssd" ) { // SATA SSD
+		profile.latency = 90;
+		profile.bandwidth = 530;
+		profile.queue_depth = 32;
+	}
+	else if( name == "nvme" ) {
+		profile.latency = 20;
+		profile.bandwidth = 3000;
+		profile.queue_depth = 64;
+	}
+	else {
+		profile.name = "fixed";
+		profile.latency = fixed_latency;
+		profile.bandwidth = 0;
+		profile.queue_depth = 0;
+	}
+	return profile;
+}
+
+struct DiskEvent
+{
+	long double time; // completion
+	long bytes;
+	bool demand;
+
+	bool operator>( const DiskEvent &other ) const
+	{ return time > other.time; }
+};
+
+class Disk_Model
+{
+
+	private :
+	DeviceProfile profile;
+	/* completions that have not happened yet */
+	priority_queue< DiskEvent, vector<DiskEvent>, greater<DiskEvent> > events;
+	/* when each queue slot becomes free */
+	priority_queue< long double, vector<long double>, greater<long double> > slots;
+	/* transfers share the bus one at a time */
+	long double bus_free;
+
+	public :
+	/* statistics */
+	long demand_requests, prefetch_requests;
+	long double demand_bytes, prefetch_bytes;
+	long double demand_time, demand_max; // seconds from submit to completion
+	long double demand_queued; // seconds demand requests waited behind others
+	long queue_total, queue_max; // requests in flight seen by each submit
+
+	Disk_Model();
+	Disk_Model( DeviceProfile );
+	DeviceProfile getProfile()
+	{ return profile; }
+
+	/* retire every request that completed by now */
+	void advance( long double );
+	/* queue a request at time now, returns the time it completes */
+	long double submit( long double, long, bool );
+	/* requests still in flight */
+	int inFlight()
+	{ return events.size(); }
+
+	void report();
+};
+
+Disk_Model::Disk_Model()
+{
+	*this = Disk_Model( deviceProfile( "fixed", 0 ) );
+}
+
+Disk_Model::Disk_Model( DeviceProfile device )
+{
+	profile = device;
+	bus_free = 0;
+	demand_requests = 0;
+	prefetch_requests = 0;
+	demand_bytes = 0;
+	prefetch_bytes = 0;
+	demand_time = 0;
+	demand_max = 0;
+	demand_queued = 0;
+	queue_total = 0;
+	queue_max = 0;
+	for( int i = 0; i < profile.queue_depth; i++ )
+		slots.push( 0 );
+}
+
+void Disk_Model::advance( long double now )
+{
+	while( !events.empty() && events.top().time <= now )
+		events.pop();
+}
+
+long double Disk_Model::submit( long double now, long bytes, bool demand )
+{
+	advance( now );
+	queue_total += events.size();
+	if( (long)events.size() > queue_max )
+		queue_max = events.size();
+
+	/* wait for a free slot in the device queue */
+	long double start = now;
+	if( profile.queue_depth > 0 )
+	{
+		if( slots.top() > start )
+			start = slots.top();
+		slots.pop();
+	}
+	long double queued = start - now;
+
+	/* the access latency overlaps with other requests, the transfer does not */
+	long double transfer_start = start + profile.latency*0.000001;
+	long double completion = transfer_start;
+	if( profile.bandwidth > 0 )
+	{
+		if( bus_free > transfer_start )
+			transfer_start = bus_free;
+		completion = transfer_start + ( bytes/profile.bandwidth )*0.000001;
+		bus_free = completion;
+	}
+	if( profile.queue_depth > 0 )
+		slots.push( completion );
+
+	DiskEvent event;
+	event.time = completion;
+	event.bytes = bytes;
+	event.demand = demand;
+	events.push( event );
+
+	if( demand )
+	{
+		demand_requests++;
+		demand_bytes += bytes;
+		demand_time += completion - now;
+		demand_queued += queued;
+		if( completion - now > demand_max )
+			demand_max = completion - now;
+	}
+	else
+	{
+		prefetch_requests++;
+		prefetch_bytes += bytes;
+	}
+	return completion;
+}
+
+void Disk_Model::report()
+{
+	long requests = demand_requests + prefetch_requests;
+	cout << "---------- Device : " << profile.name << " ----------" << endl;
+	cout << "Demand Requests : " << demand_requests << " ( " << (long)demand_bytes << " bytes )" << endl;
+	cout << "Prefetch Requests : " << prefetch_requests << " ( " << (long)prefetch_bytes << " bytes )" << endl;
+	if( demand_requests )
+	{
+		cout << "Average Demand Latency (us) : " << (double)( demand_time/demand_requests*1000000 ) << endl;
+		cout << "Maximum Demand Latency (us) : " << (double)( demand_max*1000000 ) << endl;
+		cout << "Average Demand Queueing (us) : " << (double)( demand_queued/demand_requests*1000000 ) << endl;
+	}
+	if( requests )
+		cout << "Average Requests In Flight : " << (double)queue_total/requests << " ( max " << queue_max << " )" << endl;
+}
+
+#endif
@@ -1,4 +1,7 @@
 /* To produce proper traces use the following Unix command and opts :   strace -tt -e trace=open -o trace.txt ./Driver [args] */ 
+/* To simulate while the application runs :   strace -tt -e trace=open -o /dev/stdout ./app | ./Driver - [args] */
+/* or with much less overhead :   ./Driver - [args] --capture   and   LD_PRELOAD=./capture_shim.so ./app   ( see Capture_Shim.cpp ) */
+/* Build :   g++ -O2 -o Driver Driver.cpp -lz -lpthread   ( add -DHAVE_ZSTD -lzstd for zstd traces, -DNO_ZLIB to drop gzip, -DVERBOSE_REQUESTS to print every call and the buffers ) */
 
 #include <iomanip>
 #include <stdlib.h>
@@ -15,6 +18,10 @@
 #include "FS_Simulator.h"
 #include "Cache_Manager.h"
 #include "Probability_Graph.h"
+#include "Capture_Receiver.h"
+#include "Trace_Format.h"
+#include "Trace_Input.h"
+#include "Graph_Builder.h"
 
 
 #define MAX_TRACE_CALLS 10000
@@ -56,235 +63,674 @@ bool myfunction (SystemCall *first, SystemCall *second)
 string TraceLoader::getData()
 {
 
-	/* create an input stream to collect the trace data into a single string array */
-	ifstream in( traceFile.c_str() );
+	/* create an input stream to collect the trace data into a single string array ( decompressing it if needed ) */
+	TraceInput input( traceFile );
+	if( !input.isOpen() )
+		return "";
+	istream &in = input.stream();
 	string data = "", buffer;
-	while( ! in.eof() )
+	while( getline( in, buffer ) )
 	{
-		getline( in, buffer);
 		data += buffer;
 		data += "\n";
 	}	
+	if( input.error() != "" )
+		cout << "Error: " << traceFile << " : " << input.error() << endl;
 	return data;
 }
 
 /* load System Calls into calls set */
-void TraceLoader::parse(string traceData)
+void TraceLoader::parse(string &traceData)
 {
-	/* break down the long string into single lines using a tokenizer */
-	char * pch;
-	pch = strtok ((char *)traceData.c_str(), "\r\n");
+	/* break down the long string into single lines using a tokenizer ( in place ) */
+	char *line_state;
+	char *line = strtok_r ((char *)traceData.c_str(), "\r\n", &line_state);
 
-	/* create a string vector to hold each line in the trace */
-	vector<string> sysCalls;
+	/* use this data to build our SystemCall struct Array */
+	SystemCall newCall;
+	for( ; line != NULL; line = strtok_r (NULL, "\r\n", &line_state))
+	{
+		if( parse_line( line, newCall ) )
+			calls.push_back( records.push_back( newCall ) );
+	}	
+}
+
+/* load System Calls into calls set */
+void TraceLoader::parse_seers(string &traceData)
+{
+	/* break down the long string into single lines using a tokenizer ( in place ) */
+	char *line_state;
+	char *line = strtok_r ((char *)traceData.c_str(), "\r\n", &line_state);
+
+	/* use this data to build our SystemCall struct Array */
+	SystemCall newCall;
+	for( ; line != NULL; line = strtok_r (NULL, "\r\n", &line_state))
+	{
+		if( parse_seers_line( line, newCall ) )
+			calls.push_back( records.push_back( newCall ) );
+	}	
+}
+
+int TraceLoader::processOf( int thread )
+{
+	map<int, int>::iterator it = processes.find( thread );
+	return it == processes.end() ? thread : it->second;
+}
 
-	while( pch != NULL)
+/* a thread ( CLONE_THREAD ) shares the descriptors of its process, a child process gets its own table */
+/* holding the files open in the parent */
+void TraceLoader::startProcess( int parent, int child, bool thread )
+{
+	if( thread )
 	{
-		sysCalls.push_back(&pch[0]);
-		pch = strtok (NULL, "\r\n");
+		processes[child] = parent;
+		return;
 	}
+	processes.erase( child );
+	map< pair<int, int>, shared_ptr<OpenFile> >::iterator it = descriptors.lower_bound( make_pair( parent, -1 ) );
+	for( ; it != descriptors.end() && it->first.first == parent; it++ )
+		descriptors[ make_pair( child, it->first.second ) ] = it->second;
+}
 
-	/* use this data to build our SystemCall struct Array */
-	for( int i = 0; i < sysCalls.size(); i++)
+/* strace -tt line : [PID] HH:MM:SS.usec open("file", flags) = fd */
+/* with reads also read(fd, "data"..., count) = bytes, pread64(fd, "data"..., count, offset) = bytes, lseek(fd, offset, whence) = position, */
+/* close(fd) = 0, dup(fd) = fd2 ( dup2, dup3, fcntl(fd, F_DUPFD, ...) ) and, with strace -f, clone(...) = tid ( clone3, fork, vfork ) */
+bool TraceLoader::parse_line(char *line, SystemCall &newCall)
+{
+	/* strace -f puts the PID before the time, strace -o without -f does not */
+	char *space = strchr( line, ' ' );
+	char *colon = strchr( line, ':' );
+	int offset = ( colon == NULL || ( space != NULL && space < colon ) ) ? 1 : 0;
+	int thread = offset ? atoi( line ) : 0;
+
+	/* strace -f splits a call that another thread interrupted into "call(args <unfinished ...>" and a later */
+	/* "<... call resumed>args) = result" of the same thread, the two are put back together at the time it started */
+	char *paren = strchr( line, '(' );
+	char *resumed = strstr( line, "<... " );
+	if( resumed != NULL && ( paren == NULL || resumed < paren ) )
+	{
+		map<int, string>::iterator first = unfinished.find( thread );
+		char *rest = strstr( resumed, " resumed>" );
+		if( first == unfinished.end() || rest == NULL )
+			return false;
+		resumed_line = first->second + ( rest + 9 );
+		unfinished.erase( first );
+		return parse_line( &resumed_line[0], newCall );
+	}
+	size_t length = strlen( line );
+	while( length && line[length - 1] == ' ' )
+		length--;
+	if( length >= 16 && strncmp( line + length - 16, "<unfinished ...>", 16 ) == 0 )
+	{
+		unfinished[thread] = string( line, length - 16 );
+		return false;
+	}
+
+	/* read data can hold any character, so take the descriptor, last argument and result from the raw line */
+	long result = -1, last_argument = 0;
+	int fd = -1;
+	char *equals = NULL;
+	for( char *found = strstr( line, ") = " ); found != NULL; found = strstr( found + 1, ") = " ) )
+		equals = found;
+	if( equals != NULL && paren != NULL && paren < equals )
+	{
+		result = atol( equals + 4 );
+		fd = atoi( paren + 1 );
+		char *comma = equals;
+		while( comma > paren && *comma != ',' )
+			comma--;
+		last_argument = atol( comma + 1 );
+	}
+	else if( reads )
+		return false;
+	bool new_thread = strstr( line, "CLONE_THREAD" ) != NULL;
+	bool duplicate = strstr( line, "F_DUPFD" ) != NULL;
+
+	char *pch = strtok (line, "=:, ()\"");
+	vector<string> callFields;
+	while( pch != NULL )
+	{
+		callFields.push_back( &pch[0] );
+		pch = strtok (NULL, "=:, ()\"");
+	}
+	if( callFields.size() < offset + 5 )
+		return false;
+
+	/* make sure it is not the quit call that we add */
+	string callType = callFields[offset + 3];
+	if( callType == "+++" || callType == "---" || callType[0] == '<' )
+		return false;
+
+	/* with these fields create our struct */		
+	int file_field = offset + 4;
+	/* openat(AT_FDCWD, "file", flags) is the same as an open */
+	if( callType == "openat" )
+	{
+		callType = "open";
+		file_field++;
+		if( callFields.size() <= file_field )
+			return false;
+	}
+	/* the threads of a process are one stream and share its descriptors */
+	newCall.pid = processOf( thread );
+	newCall.program = "";
+	newCall.offset = 0;
+
+	if( callType == "clone" || callType == "clone3" || callType == "fork" || callType == "vfork" )
+	{
+		if( result > 0 )
+			startProcess( newCall.pid, result, new_thread );
+		return false;
+	}
+
+	if( reads && callType != "open" )
 	{
-		string currLine = sysCalls.at(i);
-		pch = strtok ((char *)currLine.c_str(), "=:, ()\"");
-		
-		vector<string> callFields;
-		while( pch != NULL )
+		if( result < 0 )
+			return false; // a failed call
+		map< pair<int, int>, shared_ptr<OpenFile> >::iterator open_file = descriptors.find( make_pair( newCall.pid, fd ) );
+		/* the new descriptor is the same open file ( and position ) as the old one */
+		if( callType == "dup" || callType == "dup2" || callType == "dup3" || ( callType == "fcntl" && duplicate ) )
 		{
-			callFields.push_back( &pch[0] );
-			pch = strtok (NULL, "=:, ()\"");
+			pair<int, int> copy( newCall.pid, (int)result );
+			if( open_file == descriptors.end() )
+				descriptors.erase( copy );
+			else if( result != fd )
+				descriptors[copy] = open_file->second;
+			return false;
 		}
-		
-		/* with these fields create our struct */		
-		SystemCall *newCall = new SystemCall;
-		newCall->callType = callFields[4]; 
-		/* make sure it is not the quit call that we add */
-		if( callFields[4] == "+++" || callFields[4] == "---")
-			continue;
-		newCall->file = callFields[5];
-		newCall->streamID = atoi( callFields[ callFields.size() - 1].c_str() );
+		if( open_file == descriptors.end() )
+			return false; // not a traced file ( a pipe, socket, ... )
+		OpenFile &descriptor = *open_file->second;
+		if( callType == "close" )
+		{
+			descriptors.erase( open_file );
+			return false;
+		}
+		if( callType == "lseek" )
+		{
+			descriptor.position = result;
+			return false;
+		}
+		if( callType != "read" && callType != "pread64" && callType != "pread" )
+			return false;
+		newCall.offset = ( callType == "read" ) ? descriptor.position : last_argument;
+		if( callType == "read" )
+			descriptor.position += result;
+		/* nothing read at the end of the file */
+		if( result == 0 )
+			return false;
+		newCall.callType = "read";
+		newCall.file = descriptor.file;
+		newCall.streamID = fd;
+		newCall.bytes = result;
+	}
+	else
+	{
+		newCall.callType = callType; 
+		newCall.file = callFields[file_field];
+		newCall.streamID = atoi( callFields[ callFields.size() - 1].c_str() );
 
-		/* get total size in bytes bytes and inode number */
-		int open_stat, f_stat;
-		open_stat = open( newCall->file.c_str(), O_RDONLY);
+		/* get total size in bytes */
 		struct stat buff;
-		if(open_stat >= -1)
-			f_stat = fstat(open_stat, &buff);
-		
-		if(f_stat >= 0)
-			newCall->bytes = buff.st_size;
+		if( stat( newCall.file.c_str(), &buff ) == 0 )
+			newCall.bytes = buff.st_size;
 		else
-			newCall->bytes = 512;
-
-		newCall->hourTime = atoi( callFields[1].c_str() );
-		newCall->minuteTime = atoi( callFields[2].c_str() );
-		/* break up the seconds and the milliseconds */
-		int index = callFields[3].find_first_of(".");
-		newCall->secondTime = atoi( callFields[3].substr(0, index).c_str() );
-		newCall->microSecondTime = atoi ( callFields[3].substr( index + 1, callFields[3].length() ).c_str() );
-		
-		calls.push_back(newCall);		 
-	}	
+			newCall.bytes = 512;
+
+		/* reads on the descriptor are from this file */
+		if( reads && result >= 0 )
+		{
+			shared_ptr<OpenFile> descriptor = make_shared<OpenFile>();
+			descriptor->file = newCall.file;
+			descriptor->position = 0;
+			descriptors[ make_pair( newCall.pid, (int)result ) ] = descriptor;
+		}
+	}
+
+	newCall.hourTime = atoi( callFields[offset].c_str() );
+	newCall.minuteTime = atoi( callFields[offset + 1].c_str() );
+	/* break up the seconds and the milliseconds */
+	int index = callFields[offset + 2].find_first_of(".");
+	newCall.secondTime = atoi( callFields[offset + 2].substr(0, index).c_str() );
+	newCall.microSecondTime = atoi ( callFields[offset + 2].substr( index + 1, callFields[offset + 2].length() ).c_str() );
+	return true;
 }
 
-/* load System Calls into calls set */
-void TraceLoader::parse_seers(string traceData)
+/* SEER line : id UID uid PID pid program A seconds.usec open("file", flags, bytes) = fd */
+bool TraceLoader::parse_seers_line(char *line, SystemCall &newCall)
 {
-	/* break down the long string into single lines using a tokenizer */
-	char * pch;
-	pch = strtok ((char *)traceData.c_str(), "\r\n");
+	char *pch = strtok (line, "=:, ()\"");
+	vector<string> callFields;
+	while( pch != NULL )
+	{
+		callFields.push_back( &pch[0] );
+		pch = strtok (NULL, "=:, ()\"");
+	}
+	if( callFields.size() < 12 )
+		return false;
+	
+	/* make sure it is not the quit call that we add */
+	if( callFields[8] == "+++" || callFields[8] == "---")
+		return false;
+	/* with these fields create our struct */		
+	newCall.callType = callFields[8]; 
+	newCall.file = callFields[9];
+	newCall.streamID = atoi( callFields[ callFields.size() - 1].c_str() );
+	newCall.pid = atoi( callFields[4].c_str() );
+	newCall.program = callFields[5];
+
+	/* get total size in bytes bytes and inode number */
+	newCall.bytes = atoi( callFields[11].c_str());
+	if( newCall.bytes == 0)
+		newCall.bytes = 512;
+	newCall.offset = 0;
+
+	/* seconds and microseconds */
+	int index = callFields[7].find_first_of(".");
+	long first_part = atol( callFields[7].substr(0, index).c_str() );
+	newCall.microSecondTime = atoi ( callFields[7].substr( index + 1, callFields[7].length() ).c_str() );
+	
+	int hours = first_part/3600;
+	first_part -= hours*3600;
+
+	int minutes = first_part/60;
+	first_part -= minutes*60;
 
-	/* create a string vector to hold each line in the trace */
-	vector<string> sysCalls;
+	newCall.hourTime = hours%24;
+	newCall.minuteTime = minutes%60;
+	newCall.secondTime = first_part;
+	return true;
+}
 
-	while( pch != NULL)
+SystemCall* TraceLoader::next(istream &in, bool seers)
+{
+	string buffer;
+	SystemCall newCall;
+	while( getline( in, buffer ) )
 	{
-		sysCalls.push_back(&pch[0]);
-		pch = strtok (NULL, "\r\n");
+		bool parsed = seers ? parse_seers_line( (char *)buffer.c_str(), newCall ) : parse_line( (char *)buffer.c_str(), newCall );
+		if( parsed )
+			return intern( newCall );
 	}
+	return NULL;
+}
 
-	/* use this data to build our SystemCall struct Array */
-	for( int i = 0; i < sysCalls.size(); i++)
+SystemCall* TraceLoader::intern(SystemCall &newCall)
+{
+	/* reuse the record for this file so the graph, window and buffers keep pointing at it */
+	/* ( reads of it get their own record, the graph keeps the size of the file ) */
+	string key = ( newCall.callType == "read" ) ? "read " + newCall.file : newCall.file;
+	map<string, SystemCall*>::iterator it = files.find( key );
+	if( it == files.end() )
+		it = files.insert( make_pair( key, records.push_back( newCall ) ) ).first;
+	else
+		*it->second = newCall;
+	return it->second;
+}
+
+/* options after the required args : --name=value or --name */
+map<string, string> parseOptions( int argc, char *argv[], int first )
+{
+	map<string, string> options;
+	for( int i = first; i < argc; i++ )
 	{
-		string currLine = sysCalls.at(i);
-		pch = strtok ((char *)currLine.c_str(), "=:, ()\"");
-		
-		vector<string> callFields;
-		while( pch != NULL )
-		{
-			callFields.push_back( &pch[0] );
-			pch = strtok (NULL, "=:, ()\"");
-		}
-		
-		/* with these fields create our struct */		
-		SystemCall *newCall = new SystemCall;
-		newCall->callType = callFields[8]; 
-		/* make sure it is not the quit call that we add */
-		if( callFields[8] == "+++" || callFields[8] == "---")
+		string arg = argv[i];
+		if( arg.compare( 0, 2, "--" ) != 0 )
 			continue;
-		newCall->file = callFields[9];
-		newCall->streamID = atoi( callFields[ callFields.size() - 1].c_str() );
+		int index = arg.find( "=" );
+		if( index == string::npos )
+			options[ arg.substr(2) ] = "true";
+		else
+			options[ arg.substr( 2, index - 2 ) ] = arg.substr( index + 1 );
+	}
+	return options;
+}
 
-		/* get total size in bytes bytes and inode number */
-		newCall->bytes = atoi( callFields[11].c_str());
-		if( newCall->bytes == 0)
-			newCall->bytes = 512;
+/* name:value,name:value lists of the per process options */
+map<string, double> parseList( string list )
+{
+	map<string, double> values;
+	stringstream in( list );
+	string item;
+	while( getline( in, item, ',' ) )
+	{
+		int index = item.rfind( ":" );
+		if( index != string::npos )
+			values[ item.substr( 0, index ) ] = atof( item.substr( index + 1 ).c_str() );
+	}
+	return values;
+}
 
-		/* seconds and microseconds */
-		int index = callFields[7].find_first_of(".");
-		long first_part = atol( callFields[7].substr(0, index).c_str() );
-		newCall->microSecondTime = atoi ( callFields[7].substr( index + 1, callFields[7].length() ).c_str() );
-		
-		int hours = first_part/3600;
-		first_part -= hours*3600;
+/* keeps the gaps between simulated calls the same as in the trace ( waits at most 0.05 seconds ) */
+struct ReplayClock
+{
+	Timestamp previous_time;
+	long long previous_call_time; // microseconds
+	bool started;
 
-		int minutes = first_part/60;
-		first_part -= minutes*60;
+	ReplayClock()
+	{ started = false; }
 
-		newCall->hourTime = hours%24;
-		newCall->minuteTime = minutes%60;
-		newCall->secondTime = first_part;
+	void wait( SystemCall *call )
+	{
+		long long current_call_time = microseconds( *call );
+		if( started )
+		{
+			long double elapsed_goal = ( current_call_time - previous_call_time )*0.000001;
+			if( elapsed_goal < 0 || elapsed_goal > 0.05 )
+				elapsed_goal = 0.05; // we dont want to wait an hour or day or minute
+			Timestamp now;
+			do
+				now.stamp();
+			while( (now.time - previous_time.time) - elapsed_goal <= -0.00001 );
+		}
+		previous_time.stamp();
+		previous_call_time = current_call_time;
+		started = true;
+	}
+};
 
+/* convert a text trace to the binary format : ./Driver --convert [text trace] [binary trace] [--format=strace|seer] */
+int convert( int argc, char *argv[] )
+{
+	if( argc < 4 )
+	{
+		cout << "Error: ./Driver --convert [text trace] [binary trace] [--format=strace|seer]" << endl;
+		return 1;
+	}
+	map<string, string> options = parseOptions( argc, argv, 4 );
+	TraceInput input( argv[2] );
+	if( !input.isOpen() )
+	{
+		cout << "Error: cannot read " << argv[2] << endl;
+		return 1;
+	}
+	istream &in = input.stream();
+
+	/* records are written as they are parsed, so one record per file is enough */
+	TraceLoader loader( argv[2] );
+	TraceWriter writer;
+	SystemCall *call;
+	long count = 0;
+	while( (call = loader.next( in, options["format"] == "seer" )) != NULL )
+	{
+		writer.add( *call );
+		count++;
+	}
+	if( input.error() != "" )
+	{
+		cout << "Error: " << argv[2] << " : " << input.error() << endl;
+		return 1;
+	}
+	if( !writer.write( argv[3] ) )
+	{
+		cout << "Error: cannot write " << argv[3] << endl;
+		return 1;
+	}
+	cout << "Converted " << count << " calls" << endl;
+	return 0;
+}
 
-		/* insert this into our set graph*/				
-		calls.push_back(newCall);
-		 
-	}	
+/* build the graph of a trace on every core : ./Driver --train [trace] [lookahead window] [graph file] [--threads=N] [--format=strace|seer] */
+int train( int argc, char *argv[] )
+{
+	if( argc < 5 )
+	{
+		cout << "Error: ./Driver --train [trace] [lookahead window] [graph file] [--threads=N] [--format=strace|seer]" << endl;
+		return 1;
+	}
+	map<string, string> options = parseOptions( argc, argv, 5 );
+	lookahead_window = atoi( argv[3] );
+	int threads = options.count("threads") ? atoi( options["threads"].c_str() ) : thread::hardware_concurrency();
+
+	/* the records are shared by the calls to each file, so reading weeks of trace only keeps the opens */
+	/* ( the builder and the graph point at them, so the trace that owns them lives until the graph is saved ) */
+	Graph_Builder builder;
+	TraceLoader loader( argv[2] );
+	BinaryTrace *binary = NULL;
+	SystemCall *call;
+	if( isBinaryTrace( argv[2] ) )
+	{
+		binary = new BinaryTrace( argv[2] );
+		while( (call = binary->next()) != NULL )
+			builder.add( call );
+		if( binary->error() != "" )
+		{
+			cout << "Error: " << argv[2] << " : " << binary->error() << endl;
+			delete binary;
+			return 1;
+		}
+	}
+	else
+	{
+		TraceInput input( argv[2] );
+		if( !input.isOpen() )
+		{
+			cout << "Error: cannot read " << argv[2] << endl;
+			return 1;
+		}
+		while( (call = loader.next( input.stream(), options["format"] == "seer" )) != NULL )
+			builder.add( call );
+		if( input.error() != "" )
+		{
+			cout << "Error: " << argv[2] << " : " << input.error() << endl;
+			return 1;
+		}
+	}
+
+	Probability_Graph graph( lookahead_window );
+	builder.build( &graph, threads );
+	bool saved = graph.save( argv[4] );
+	delete binary;
+	if( !saved )
+	{
+		cout << "Error: cannot write " << argv[4] << endl;
+		return 1;
+	}
+	cout << "Trained " << graph.nodes.size() << " nodes from " << builder.opens() << " opens" << endl;
+	return 0;
 }
 
 int main( int argc, char *argv[])
 {
+	if( argc > 1 && string( argv[1] ) == "--convert" )
+		return convert( argc, argv );
+	if( argc > 1 && string( argv[1] ) == "--train" )
+		return train( argc, argv );
+
 	/* parse the command line args */
-	if( argc < 5 )
+	if( argc < 6 )
 	{
-		cout << "Error: need 6 args! ./Driver [test file] [cache-size] [minimum chance] [lookahead window] [prefetch option]";
+		cout << "Error: need 5 args! ./Driver [test file | - for stdin] [cache-size] [minimum chance] [lookahead window] [prefetch option] [--stream] [--format=strace|seer] [--capture[=socket]] [--device=fixed|hdd|ssd|nvme] [--queue-depth=N] [--mrc[=rate]] [--ssd-size=bytes] [--ssd-latency=us] [--ssd-policy=lru|fifo] [--prefetch-tier=dram|ssd] [--quota=name:pages,...] [--weight=name:weight,...] [--fair-share] [--reads] [--trainer] [--graph=file] [--save-graph=file] [--metrics] [--metrics-period=seconds] [--timeseries=file|false] [--timeseries-interval=us] [--cost-model=file] [--t_disk=us] [--t_cpu=us] [--adaptive=false] ..." << endl;
+		cout << "       ./Driver --convert [text trace] [binary trace] [--format=strace|seer]" << endl;
+		cout << "       ./Driver --train [trace] [lookahead window] [graph file] [--threads=N] [--format=strace|seer]" << endl;
+		cout << "       --trainer predicts from snapshots that lag the trace by however far the thread is behind in wall clock time," << endl;
+		cout << "       so its results depend on thread timing and are not reproducible from run to run" << endl;
 		return 0;
 	}
 	
 	string prefetch_arg = argv[5];
-	
+	map<string, string> options = parseOptions( argc, argv, 6 );
+	string trace_arg = argv[1];
+
 	/* prefetch / yes or no */
 	bool prefetch_option = false;
 	if( prefetch_arg.compare("true") == 0 )
 		prefetch_option = true;	
 	
+	/* strace -tt or SEER trace lines */
+	bool seers = ( options["format"] == "seer" );
+	/* read the trace as it arrives instead of loading it first ( always for stdin ) */
+	bool streaming = ( options.count("stream") || trace_arg == "-" );
+
+	/* the timing model : a --cost-model=file, then --t_disk=, --t_cpu=, ... overrides ( see Cost_Model.h ) */
+	if( options.count("cost-model") && !cost_model.load( options["cost-model"] ) )
+		cout << "Error: cannot read cost model " << options["cost-model"] << endl;
+	for( map<string, string>::iterator it = options.begin(); it != options.end(); it++ )
+		cost_model.set( it->first, it->second );
+
+	/* the device the cache misses and prefetches are read from */
+	DeviceProfile device = deviceProfile( options.count("device") ? options["device"] : "fixed", cost_model.disk );
+	if( options.count("queue-depth") )
+		device.queue_depth = atoi( options["queue-depth"].c_str() );
+	/* plan prefetches around the latency of that device unless t_disk was given ( by --t_disk= or the cost model file ) */
+	if( !cost_model.disk_given )
+	{
+		cost_model.disk = device.latency;
+		cost_model.derive();
+	}
 
 	/* create our Cache_Manager */
 	Cache_Manager cache_manager(prefetch_option, atoi(argv[2]), atof(argv[3]), atoi(argv[4]) );
 	Cache_Manager *ptr = &cache_manager;
+	cache_manager.setDevice( device );
+
+	/* a local SSD ( or other tier ) between the cache and the device : --ssd-size=bytes [--ssd-latency=us] [--ssd-policy=lru|fifo] [--prefetch-tier=ssd] */
+	if( options.count("ssd-size") )
+	{
+		DeviceProfile tier = deviceProfile( "ssd", cost_model.disk );
+		if( options.count("ssd-latency") )
+			tier.latency = atof( options["ssd-latency"].c_str() );
+		cache_manager.setSecondTier( atol( options["ssd-size"].c_str() ), tier, options.count("ssd-policy") ? options["ssd-policy"] : "lru", options["prefetch-tier"] == "ssd" );
+	}
+
+	/* per process sharing of the cache : --quota=program:pages,... --weight=program:weight,... --fair-share */
+	/* processes are named by program ( SEER, capture ) or by pid ( strace -f ) */
+	map<string, long> quotas;
+	map<string, double> quota_list = parseList( options["quota"] );
+	for( map<string, double>::iterator it = quota_list.begin(); it != quota_list.end(); it++ )
+		quotas[it->first] = (long)it->second;
+	cache_manager.setStreamPolicy( quotas, parseList( options["weight"] ), options.count("fair-share") );
+
+	/* start from a graph trained earlier ( ./Driver --train ) */
+	if( options.count("graph") && !cache_manager.loadGraph( options["graph"] ) )
+	{
+		cout << "Error: cannot load graph " << options["graph"] << endl;
+		return 0;
+	}
+
+	/* learn the graph on its own thread, prediction reads the snapshots it publishes. how stale they are is measured */
+	/* in wall clock time ( GRAPH_SNAPSHOT_DELAY ), not trace time, so two runs of the same trace can predict differently */
+	if( options.count("trainer") )
+		cache_manager.trainInBackground();
+
+	/* the buffers every 50 ms of the trace into graph_data.csv : --timeseries=file|false --timeseries-interval=us */
+	string series_path = options.count("timeseries") && options["timeseries"] != "true" ? options["timeseries"] : "graph_data.csv";
+	if( series_path != "false" )
+	{
+		long long interval = options.count("timeseries-interval") ? atoll( options["timeseries-interval"].c_str() ) : 50000;
+		if( !cache_manager.recordTimeSeries( series_path, interval ) )
+			cout << "Error: cannot write " << series_path << endl;
+	}
+
+	/* counters of the run at the end ( --metrics ) and every so many seconds of it ( --metrics-period=s ) */
+	bool print_metrics = options.count("metrics") || options.count("metrics-period");
+	if( options.count("metrics-period") )
+		metrics.setPeriod( atof( options["metrics-period"].c_str() ) );
+
+	/* hit ratio of every cache size from this one run, --mrc samples 1% of the blocks */
+	if( options.count("mrc") )
+		cache_manager.enableMissRatioCurve( options["mrc"] == "true" ? 0.01 : atof( options["mrc"].c_str() ) );
 	
 	/* create our FS_Simulator */
 	FS_Simulator fs_sim(ptr);
 	
-	/* use TraceLoader to load our simulation data */
-	TraceLoader test( argv[1] );
-	string data = test.getData();
-	test.parse(data); // produces a vector of SystemCalls ordered by time ( microseconds )
-
-	/* Simulate Application system calls */
-
-	Timestamp now;
-	now.stamp();
-	double long previous_time = now.time;
-	SystemCall* previous_call = *test.calls.begin();
-	vector<SystemCall*>::iterator it = test.calls.begin();
-	++it;
-
+	TraceLoader test( trace_arg );
+	BinaryTrace *binary = NULL;
 
+	/* strace traces with reads ( strace -f -tt -e trace=open,openat,read,pread64,lseek,close,dup,dup2,dup3,fcntl,clone,clone3,fork,vfork ) : */
+	/* the blocks are charged by the reads, sequential ones are read ahead and the graph predicts the next files from the opens. */
+	/* with -f the clone calls tell which threads share a process's descriptors */
+	if( options.count("reads") )
+	{
+		test.reads = true;
+		cache_manager.setReadGranularity( true );
+	}
 
-	/* convert each to seconds */
-	long double previous_call_time = 3600*previous_call->hourTime; 
-	previous_call_time += 60*previous_call->minuteTime;
-	previous_call_time += previous_call->secondTime;
-	previous_call_time += (double)0.000001*(previous_call->microSecondTime);
+	/* every simulated call waits for the gap it had in the trace */
+	ReplayClock replay;
 
-	long double current_call_time = 3600*(*it)->hourTime; 
-	current_call_time += 60*(*it)->minuteTime;
-	current_call_time += (*it)->secondTime;
-	current_call_time += (double)0.000001*((*it)->microSecondTime);
+	/* Receive system calls from processes running with the capture shim preloaded */
+	if( options.count("capture") )
+	{
+		string socket_path = options["capture"];
+		if( socket_path == "true" )
+			socket_path = CAPTURE_SOCKET;
+		CaptureReceiver receiver( socket_path );
+		SystemCall newCall;
+		while( receiver.receive( newCall ) )
+		{
+			SystemCall *call = test.intern( newCall );
+			replay.wait( call );
+			VERBOSE( systemCallToString( *call ); )
+			fs_sim.sendRequest( call );
+		}
+		if( receiver.dropped )
+			cout << "Capture records dropped : " << receiver.dropped << endl;
+	}
 
-	long double elapsed_goal = current_call_time - previous_call_time;
+	/* Stream system calls from a pipe, FIFO or file : e.g. strace -tt -e trace=open -o /dev/stdout ./app | ./Driver - ... */
+	else if( streaming )
+	{
+		/* gzip and zstd input is decompressed on a separate thread */
+		TraceInput input( trace_arg );
+		if( !input.isOpen() )
+		{
+			cout << "Error: cannot read " << trace_arg << endl;
+			return 0;
+		}
+		istream *in = &input.stream();
+		/* calls are simulated as they arrive, a live producer is never ahead of the trace times */
+		SystemCall *call;
+		while( (call = test.next( *in, seers )) != NULL )
+		{
+			replay.wait( call );
+			VERBOSE( systemCallToString( *call ); )
+			fs_sim.sendRequest( call );
+		}
+		if( input.error() != "" )
+			cout << "Error: " << trace_arg << " : " << input.error() << endl;
+	}
 
-	if(elapsed_goal < 0 )
-		elapsed_goal = 0.05; //seconds
+	/* Replay a binary trace ( see Trace_Format.h ) straight from the mapped file */
+	else if( isBinaryTrace( trace_arg ) )
+	{
+		/* the graph's nodes point at its records, so it is kept until the graph is reported and saved */
+		binary = new BinaryTrace( trace_arg );
+		SystemCall *call;
+		while( (call = binary->next()) != NULL )
+		{
+			replay.wait( call );
+			VERBOSE( systemCallToString( *call ); )
+			fs_sim.sendRequest( call );
+		}
+		if( binary->error() != "" )
+			cout << "Error: " << trace_arg << " : " << binary->error() << endl;
+	}
 
-	if(elapsed_goal > 5)
-		elapsed_goal = 0.05; // wait one second if it is like an hour or day or minute- we dont want to wait that long
-	while(it != test.calls.end() )
+	else
 	{
-		now.stamp();
-		if((now.time - previous_time) - elapsed_goal > -0.00001) {
-			systemCallToString( **it );
-			fs_sim.sendRequest( *it );
-			previous_call = *it;
-			previous_time = now.time;
-			previous_call_time = 0.0;
-			current_call_time = 0.0;
-			/* convert each to seconds */
-			previous_call_time += 3600*previous_call->hourTime; 
-			previous_call_time += 60*previous_call->minuteTime;
-			previous_call_time += previous_call->secondTime;
-			previous_call_time += (double)0.000001*(previous_call->microSecondTime);
-			it++;
-			current_call_time += 3600*(*it)->hourTime; 
-			current_call_time += 60*(*it)->minuteTime;
-			current_call_time += (*it)->secondTime;
-			current_call_time += (double)0.000001*((*it)->microSecondTime);
-
-			elapsed_goal = current_call_time - previous_call_time;
-
-			if(elapsed_goal < 0 )
-				elapsed_goal = 0.05; //seconds
-
-			if(elapsed_goal > 0.05)
-				elapsed_goal = 0.05;
-		}			
-	} // end while
+		/* use TraceLoader to load our simulation data */
+		string data = test.getData();
+		if( seers )
+			test.parse_seers(data);
+		else
+			test.parse(data); // produces a vector of SystemCalls ordered by time ( microseconds )
 
-	
+		/* Simulate Application system calls */
+		for( vector<SystemCall*>::iterator it = test.calls.begin(); it != test.calls.end(); it++ )
+		{
+			replay.wait( *it );
+			VERBOSE( systemCallToString( **it ); )
+			fs_sim.sendRequest( *it );
+		}
+	}
 
-	
+	cache_manager.report();
+	if( print_metrics )
+		metrics.report();
+	if( options.count("save-graph") && !cache_manager.saveGraph( options["save-graph"] ) )
+		cout << "Error: cannot write " << options["save-graph"] << endl;
+	delete binary;
 	return 0;
 }
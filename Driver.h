@@ -5,8 +5,11 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include <memory>
 #include <math.h>
 #include <iomanip>
+#include "Object_Pool.h"
 
 using namespace std;
 
@@ -20,7 +23,11 @@ struct SystemCall{
   short  minuteTime;
   int  secondTime;
   long   microSecondTime;
-  long   bytes;
+  long   bytes; // the size of the file, or of the read
+  long   offset; // where a read starts in its file
+  /* the process that made the call ( 0 and empty when the trace does not say ) */
+  int    pid;
+  string program;
 
   /* used to calculate locality of reference */
   double access_latency;
@@ -39,6 +46,9 @@ struct SystemCall{
 			(*this).secondTime = rhs.secondTime;
 			(*this).microSecondTime = rhs.microSecondTime;	
 			(*this).bytes = rhs.bytes;
+			(*this).offset = rhs.offset;
+			(*this).pid = rhs.pid;
+			(*this).program = rhs.program;
 		 }
 		
      		return *this;
@@ -113,29 +123,73 @@ void systemCallToString(SystemCall call)
 	cout << "Second: " << call.secondTime << endl;
 	cout << "Microsecond: " << call.microSecondTime << endl;
 	cout << "Bytes: " << call.bytes << endl ;
+	if( call.callType == "read" )
+		cout << "Offset: " << call.offset << endl;
+	if( call.pid )
+		cout << "PID: " << call.pid << " " << call.program << endl;
 }
 
 
+/* an open file of a traced process, to tell which file a read is from. descriptors made by dup or inherited */
+/* by a child share one ( and its position ) */
+struct OpenFile
+{
+	string file;
+	long position; // of the next read
+};
+
 /* Parser that will create the System Calls from the trace data */
 class TraceLoader
 {
 	private:
 	string traceFile;
+	/* ( process, fd ) -> the file it was opened on */
+	map< pair<int, int>, shared_ptr<OpenFile> > descriptors;
+	/* strace -f : thread -> its process ( the thread that started it ), known from the clone calls */
+	map<int, int> processes;
+	/* strace -f : the first half of a call another thread interrupted, by thread */
+	map<int, string> unfinished;
+	string resumed_line;
+	/* owns every SystemCall in calls */
+	Object_Pool<SystemCall> records;
+	/* streaming : the one record kept for each file */
+	map<string, SystemCall*> files;
 	public:
 	vector<SystemCall*> calls;
+	/* also produce read calls ( read/pread64 with their offsets, lseek and close move and drop descriptors ) */
+	bool reads;
 	/* constructors */
 	TraceLoader(string trfile)
-	{ traceFile = trfile; }
+	{ traceFile = trfile; reads = false; }
 	/* function to load trace data */
 	string getData();
-	/* function to parse the trace data to create SystemCall structs */
-	void parse(string);
-	
-	void parse_seers(string);
+	/* function to parse the trace data to create SystemCall structs ( tokenizes the data in place ) */
+	void parse(string&);
 	
+	void parse_seers(string&);
+
+	/* parse a single line of trace data ( false if the line is not a call ) */
+	bool parse_line(char*, SystemCall&);
+	/* the process of a thread, and what a new thread or child process starts with */
+	int processOf(int);
+	void startProcess(int, int, bool);
+	bool parse_seers_line(char*, SystemCall&);
+
+	/* streaming : read the next call from a stream ( NULL at the end ) */
+	/* memory stays bounded because every call to the same file shares one record */
+	SystemCall* next(istream&, bool);
+	/* streaming : copy a call into the record kept for its file */
+	SystemCall* intern(SystemCall&);
 	
 };
 
+/* returns the time of day in microseconds */
+long long microseconds(const SystemCall &call)
+{
+	long long seconds = call.hourTime*3600 + call.minuteTime*60 + call.secondTime;
+	return seconds*1000000 + call.microSecondTime;
+}
+
 /* returns difference in seconds */
 long double operator-(const SystemCall &lhs, const SystemCall &rhs)
 {
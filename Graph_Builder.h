@@ -0,0 +1,148 @@
+/* builds the probability graph of a whole trace offline, on every core : the opens are split into one segment per */
+/* thread, each thread counts the associations into the opens of its own segment ( looking back one lookahead window */
+/* into the segment before it ), then the counts of every node are merged into the graph CallWindow::insert would build */
+#ifndef Graph_Builder_H
+#define Graph_Builder_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include "Cache_Manager.h"
+
+using namespace std;
+
+class Graph_Builder
+{
+
+	private :
+	struct Edge
+	{
+		long strength;
+		long last; // the open that strengthened it last
+	};
+	typedef vector< map<int, Edge> > EdgeTable; // predecessor id -> successor id -> edge
+
+	/* every open in trace order */
+	vector<int> ids;
+	vector<long long> times; // microseconds, never decreasing ( see CallWindow::timeOf )
+	/* by node id */
+	vector<SystemCall*> records;
+	map<string, int> index;
+	CallWindow clock;
+
+	/* associations into the opens first to last - 1 */
+	void count( long first, long last, EdgeTable &edges )
+	{
+		edges.resize( records.size() );
+		/* the window of an open starts at the first open at most a lookahead window older, and */
+		/* holds at most CALL_WINDOW_CAPACITY opens */
+		long start = lower_bound( times.begin(), times.end(), times[first] - lookahead_window ) - times.begin();
+		for( long j = first; j < last; j++ )
+		{
+			while( times[j] - times[start] > lookahead_window )
+				start++;
+			for( long i = max( start, j - CALL_WINDOW_CAPACITY ); i < j; i++ )
+			{
+				if( ids[i] == ids[j] )
+					continue;
+				Edge &edge = edges[ ids[i] ][ ids[j] ];
+				edge.strength++;
+				edge.last = j;
+			}
+		}
+	}
+
+	/* the windows of nodes first to last - 1 */
+	void merge( int first, int last, vector<EdgeTable> &shards, Probability_Graph *graph )
+	{
+		for( int id = first; id < last; id++ )
+		{
+			map<int, Edge> merged;
+			for( int k = 0; k < shards.size(); k++ )
+				for( map<int, Edge>::iterator it = shards[k][id].begin(); it != shards[k][id].end(); it++ )
+				{
+					Edge &edge = merged[it->first];
+					edge.strength += it->second.strength;
+					edge.last = max( edge.last, it->second.last );
+				}
+
+			/* strengthen() keeps the strongest first, and of equal ones the first to reach that strength */
+			vector< pair< pair<long, long>, int > > order;
+			for( map<int, Edge>::iterator it = merged.begin(); it != merged.end(); it++ )
+				order.push_back( make_pair( make_pair( -it->second.strength, it->second.last ), it->first ) );
+			sort( order.begin(), order.end() );
+
+			Node &node = graph->nodes[id];
+			for( int i = 0; i < order.size(); i++ )
+			{
+				Association assoc;
+				assoc.id = order[i].second;
+				assoc.call = records[assoc.id];
+				assoc.strength = -order[i].first.first;
+				node.window.push_back( assoc );
+				node.successors.insert( assoc.id );
+				node.total_strength += assoc.strength;
+			}
+		}
+	}
+
+	public :
+	/* a call of the trace ( in time order ), the record has to stay the same until build() */
+	void add( SystemCall *call )
+	{
+		/* only 'open' calls are part of the graph */
+		if( call->callType != "open" )
+			return;
+		map<string, int>::iterator it = index.find( call->file );
+		if( it == index.end() )
+		{
+			it = index.insert( make_pair( call->file, (int)records.size() ) ).first;
+			records.push_back( call );
+		}
+		else
+			records[it->second] = call; // the node keeps the latest call
+		ids.push_back( it->second );
+		times.push_back( clock.timeOf( microseconds( *call ) ) );
+	}
+
+	long opens()
+	{ return ids.size(); }
+
+	/* fill an empty graph */
+	void build( Probability_Graph *graph, int threads )
+	{
+		for( int i = 0; i < records.size(); i++ )
+			graph->add( records[i] );
+		if( threads < 1 )
+			threads = 1;
+
+		/* count : one segment of the opens per thread */
+		vector<EdgeTable> shards( threads );
+		vector<thread> workers;
+		for( int k = 0; k < threads; k++ )
+		{
+			long first = opens()*k/threads, last = opens()*( k + 1 )/threads;
+			if( first < last )
+				workers.push_back( thread( &Graph_Builder::count, this, first, last, ref( shards[k] ) ) );
+		}
+		for( int k = 0; k < workers.size(); k++ )
+			workers[k].join();
+		workers.clear();
+		for( int k = 0; k < threads; k++ )
+			shards[k].resize( records.size() );
+
+		/* merge : one range of the nodes per thread */
+		for( int k = 0; k < threads; k++ )
+		{
+			int first = (long)records.size()*k/threads, last = (long)records.size()*( k + 1 )/threads;
+			if( first < last )
+				workers.push_back( thread( &Graph_Builder::merge, this, first, last, ref( shards ), graph ) );
+		}
+		for( int k = 0; k < workers.size(); k++ )
+			workers[k].join();
+	}
+};
+
+#endif
@@ -0,0 +1,200 @@
+/* named counters, gauges and histograms of the simulation, reported every --metrics-period seconds and at the end */
+/* counters and histograms are kept per thread ( a thread only writes its own block ), so counting costs an add */
+#ifndef Metrics_H
+#define Metrics_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+using namespace std;
+
+/* the per request dumps of the calls and buffers, only built with -DVERBOSE_REQUESTS */
+#ifdef VERBOSE_REQUESTS
+#define VERBOSE( ... ) __VA_ARGS__
+#else
+#define VERBOSE( ... )
+#endif
+
+#define METRICS_MAX 64 // metrics that can be defined
+#define METRICS_BUCKETS 40 // histogram buckets : [0,1), [1,2), [2,4), [4,8) ... in the unit of the histogram
+
+enum MetricKind { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+
+/* what one thread counted */
+struct MetricsBlock
+{
+	atomic<long long> counts[METRICS_MAX]; // counters, and the samples of histograms
+	atomic<long long> sums[METRICS_MAX]; // of the samples of histograms
+	atomic<long long> buckets[METRICS_MAX][METRICS_BUCKETS];
+
+	MetricsBlock()
+	{
+		for( int i = 0; i < METRICS_MAX; i++ )
+		{
+			counts[i] = 0;
+			sums[i] = 0;
+			for( int j = 0; j < METRICS_BUCKETS; j++ )
+				buckets[i][j] = 0;
+		}
+	}
+};
+
+class Metrics
+{
+
+	private :
+	struct Definition
+	{
+		string name;
+		MetricKind kind;
+		string unit;
+	};
+	vector<Definition> definitions;
+	atomic<long long> gauges[METRICS_MAX];
+	/* every thread's block, kept after the thread is gone */
+	vector<MetricsBlock*> blocks;
+	mutex lock;
+	/* periodic reports */
+	double period; // seconds, 0 : only at the end
+	chrono::steady_clock::time_point start, last_report;
+
+	MetricsBlock* block()
+	{
+		static thread_local MetricsBlock *local = NULL;
+		if( local == NULL )
+		{
+			local = new MetricsBlock();
+			unique_lock<mutex> guard( lock );
+			blocks.push_back( local );
+		}
+		return local;
+	}
+	/* only the owner writes a block, so a relaxed load and store is enough */
+	static void bump( atomic<long long> &slot, long long amount )
+	{ slot.store( slot.load( memory_order_relaxed ) + amount, memory_order_relaxed ); }
+
+	int define( string name, MetricKind kind, string unit )
+	{
+		unique_lock<mutex> guard( lock );
+		for( int i = 0; i < definitions.size(); i++ )
+			if( definitions[i].name == name )
+				return i;
+		if( definitions.size() == METRICS_MAX )
+			return METRICS_MAX - 1; // shares the last slot rather than failing
+		Definition definition;
+		definition.name = name;
+		definition.kind = kind;
+		definition.unit = unit;
+		definitions.push_back( definition );
+		return definitions.size() - 1;
+	}
+
+	/* the sum of every thread's count ( or sum of samples ) of a metric */
+	long long total( int id, bool sums = false )
+	{
+		long long sum = 0;
+		for( int i = 0; i < blocks.size(); i++ )
+			sum += ( sums ? blocks[i]->sums[id] : blocks[i]->counts[id] ).load( memory_order_relaxed );
+		return sum;
+	}
+
+	public :
+	Metrics()
+	{
+		for( int i = 0; i < METRICS_MAX; i++ )
+			gauges[i] = 0;
+		period = 0;
+		start = last_report = chrono::steady_clock::now();
+	}
+	~Metrics()
+	{
+		for( int i = 0; i < blocks.size(); i++ )
+			delete blocks[i];
+	}
+
+	/* the id of a metric ( defined the first time its name is used ), look it up once and keep it */
+	int counter( string name )
+	{ return define( name, METRIC_COUNTER, "" ); }
+	int gauge( string name )
+	{ return define( name, METRIC_GAUGE, "" ); }
+	int histogram( string name, string unit )
+	{ return define( name, METRIC_HISTOGRAM, unit ); }
+
+	void add( int id, long long amount = 1 )
+	{ bump( block()->counts[id], amount ); }
+	void set( int id, long long value )
+	{ gauges[id].store( value, memory_order_relaxed ); }
+	void record( int id, long long value )
+	{
+		MetricsBlock *local = block();
+		int bucket = 0;
+		while( bucket < METRICS_BUCKETS - 1 && value >= ( 1LL << bucket ) )
+			bucket++;
+		bump( local->counts[id], 1 );
+		bump( local->sums[id], value );
+		bump( local->buckets[id][bucket], 1 );
+	}
+
+	void setPeriod( double seconds )
+	{ period = seconds; }
+
+	/* a request was simulated : report if a period has passed */
+	void tick()
+	{
+		if( period <= 0 )
+			return;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if( chrono::duration<double>( now - last_report ).count() >= period )
+		{
+			last_report = now;
+			report();
+		}
+	}
+
+	void report()
+	{
+		unique_lock<mutex> guard( lock );
+		double elapsed = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+		cout << "---------- Metrics ( " << elapsed << " s ) ----------" << endl;
+		for( int id = 0; id < definitions.size(); id++ )
+		{
+			Definition &definition = definitions[id];
+			cout << definition.name << " : ";
+			if( definition.kind == METRIC_GAUGE )
+				cout << gauges[id].load( memory_order_relaxed ) << endl;
+			else if( definition.kind == METRIC_COUNTER )
+				cout << total( id ) << endl;
+			else
+			{
+				long long samples = total( id );
+				cout << "samples " << samples;
+				if( samples )
+				{
+					/* percentiles are the upper end of their bucket */
+					long long p50 = -1, p99 = -1, seen = 0;
+					for( int j = 0; j < METRICS_BUCKETS; j++ )
+					{
+						for( int i = 0; i < blocks.size(); i++ )
+							seen += blocks[i]->buckets[id][j].load( memory_order_relaxed );
+						if( p50 < 0 && seen*2 >= samples )
+							p50 = 1LL << j;
+						if( p99 < 0 && seen*100 >= samples*99 )
+							p99 = 1LL << j;
+					}
+					cout << " mean " << (double)total( id, true )/samples << " " << definition.unit;
+					cout << " p50 < " << p50 << " p99 < " << p99;
+				}
+				cout << endl;
+			}
+		}
+	}
+};
+
+Metrics metrics;
+
+#endif
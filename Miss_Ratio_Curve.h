@@ -0,0 +1,167 @@
+/* online miss ratio curve of the ( file, block ) stream seen by the cache, estimated in one pass */
+/* SHARDS ( Waldspurger et al. ) : only blocks whose hash falls under a threshold are tracked, so */
+/* a rate R sample sees reuse distances R times too short and every block is either always or never sampled */
+#ifndef Miss_Ratio_Curve_H
+#define Miss_Ratio_Curve_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+/* sampling threshold resolution */
+#define MRC_MODULUS ( 1ULL << 24 )
+
+/* counts of the marked times in [1, t] */
+struct FenwickTree
+{
+	vector<long> tree;
+	vector<char> marks;
+
+	void grow( long time )
+	{
+		if( time < (long)marks.size() )
+			return;
+		long size = marks.size() ? marks.size() : 1024;
+		while( size <= time )
+			size *= 2;
+		marks.resize( size, 0 );
+		/* rebuild the sums for the larger range */
+		tree.assign( size, 0 );
+		for( long i = 1; i < size; i++ )
+		{
+			tree[i] += marks[i];
+			long parent = i + ( i & -i );
+			if( parent < size )
+				tree[parent] += tree[i];
+		}
+	}
+	void add( long time, int delta )
+	{
+		marks[time] += delta;
+		for( ; time < (long)tree.size(); time += time & -time )
+			tree[time] += delta;
+	}
+	long sum( long time )
+	{
+		long total = 0;
+		for( ; time > 0; time -= time & -time )
+			total += tree[time];
+		return total;
+	}
+};
+
+class MissRatioCurve
+{
+
+	private :
+	double rate; // fraction of blocks sampled, 0 : off
+	unsigned long long threshold;
+	long time; // sampled references so far
+	long references; // all references
+	/* last access time of every sampled block */
+	map<unsigned long long, long> last;
+	FenwickTree distinct;
+	/* sampled reuse distance -> references */
+	vector<long> histogram;
+	long cold; // first references
+
+	public :
+	MissRatioCurve()
+	{
+		rate = 0;
+		threshold = 0;
+		time = 0;
+		references = 0;
+		cold = 0;
+	}
+
+	void enable( double sampling_rate )
+	{
+		rate = sampling_rate;
+		threshold = (unsigned long long)( rate*MRC_MODULUS );
+	}
+	bool enabled()
+	{ return rate > 0; }
+
+	/* hash once per file, blocks are mixed in by access */
+	static unsigned long long hashFile( const string &file )
+	{
+		unsigned long long hash = 14695981039346656037ULL; // FNV-1a
+		for( int i = 0; i < file.size(); i++ )
+		{
+			hash ^= (unsigned char)file[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	void access( unsigned long long file_hash, long block )
+	{
+		references++;
+		/* splitmix64 finalizer of the ( file, block ) key */
+		unsigned long long key = file_hash + block*0x9e3779b97f4a7c15ULL;
+		key = ( key ^ ( key >> 30 ) )*0xbf58476d1ce4e5b9ULL;
+		key = ( key ^ ( key >> 27 ) )*0x94d049bb133111ebULL;
+		key ^= key >> 31;
+		if( key % MRC_MODULUS >= threshold )
+			return;
+
+		time++;
+		distinct.grow( time );
+		map<unsigned long long, long>::iterator it = last.find( key );
+		if( it == last.end() )
+		{
+			cold++;
+			last[key] = time;
+		}
+		else
+		{
+			/* blocks touched since the last access of this one */
+			long distance = distinct.sum( time - 1 ) - distinct.sum( it->second );
+			if( distance >= (long)histogram.size() )
+				histogram.resize( distance + 1, 0 );
+			histogram[distance]++;
+			distinct.add( it->second, -1 );
+			it->second = time;
+		}
+		distinct.add( time, 1 );
+	}
+
+	/* hit ratio of an LRU cache of that many pages */
+	double hitRatio( long pages )
+	{
+		if( !time )
+			return 0;
+		/* SHARDS adjustment : the sample saw a different number of references than the rate predicts */
+		double expected = references*rate;
+		double hits = expected - time;
+		for( long d = 0; d < (long)histogram.size() && d/rate < pages; d++ )
+			hits += histogram[d];
+		if( hits < 0 )
+			hits = 0;
+		return hits/expected;
+	}
+
+	void report( long cache_pages, long block_size )
+	{
+		cout << "---------- Miss Ratio Curve ( sampling " << rate << " ) ----------" << endl;
+		cout << "References : " << references << " Sampled : " << time << " Distinct Sampled Blocks : " << last.size() << endl;
+		/* every distance the sample can tell apart, doubling in size */
+		long largest = (long)( ( histogram.size() + 1 )/rate );
+		for( long pages = (long)( 1/rate ) > 1 ? (long)( 1/rate ) : 1; ; pages *= 2 )
+		{
+			if( pages > largest )
+				pages = largest;
+			cout << setw(12) << pages << " pages " << setw(14) << pages*block_size << " bytes : hit ratio " << hitRatio( pages ) << endl;
+			if( pages == largest )
+				break;
+		}
+		cout << "Simulated Cache ( " << cache_pages << " pages ) : hit ratio " << hitRatio( cache_pages ) << endl;
+	}
+};
+
+#endif
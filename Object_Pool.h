@@ -0,0 +1,68 @@
+/* storage for objects that live as long as the simulation : allocated in chunks, released all at once */
+#ifndef Object_Pool_H
+#define Object_Pool_H
+
+#include <vector>
+
+using namespace std;
+
+#define POOL_CHUNK_SIZE 4096 // objects per chunk
+
+template <class T>
+class Object_Pool
+{
+
+	private :
+	vector<T*> chunks;
+	long count;
+
+	/* pools own their objects, so they are not copied */
+	Object_Pool( const Object_Pool& );
+	Object_Pool& operator=( const Object_Pool& );
+
+	public :
+	Object_Pool()
+	{ count = 0; }
+	~Object_Pool()
+	{ clear(); }
+
+	/* get a default constructed object that stays at the same address until clear() */
+	T* allocate()
+	{
+		if( count == (long)chunks.size()*POOL_CHUNK_SIZE )
+			chunks.push_back( new T[POOL_CHUNK_SIZE] );
+		T *object = &chunks[count/POOL_CHUNK_SIZE][count%POOL_CHUNK_SIZE];
+		count++;
+		return object;
+	}
+	/* copy an object into the pool */
+	T* push_back( const T &object )
+	{
+		T *ptr = allocate();
+		*ptr = object;
+		return ptr;
+	}
+
+	/* objects are numbered in the order they were allocated */
+	T& operator[]( long i )
+	{ return chunks[i/POOL_CHUNK_SIZE][i%POOL_CHUNK_SIZE]; }
+	const T& operator[]( long i ) const
+	{ return chunks[i/POOL_CHUNK_SIZE][i%POOL_CHUNK_SIZE]; }
+	T& back()
+	{ return (*this)[count - 1]; }
+	long size() const
+	{ return count; }
+	bool empty() const
+	{ return count == 0; }
+
+	/* release every object */
+	void clear()
+	{
+		for( int i = 0; i < chunks.size(); i++ )
+			delete [] chunks[i];
+		chunks.clear();
+		count = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,284 @@
+/* next file predictors : each one learns from the sequence of opens and predicts the node ids that follow a node */
+/* they all run in shadow for every node, and a Tournament lets the one that has been right most often there prefetch */
+#ifndef Predictor_H
+#define Predictor_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include "Probability_Graph.h"
+
+using namespace std;
+
+/* predictions of each predictor that are checked against the next open */
+#define TOURNAMENT_TOP 2
+
+/* weight of the latest outcome in a predictor's accuracy at a node */
+#define TOURNAMENT_DECAY 0.125
+
+/* how much more accurate a challenger must be than the winner of a node to replace it */
+#define TOURNAMENT_MARGIN 0.1
+
+struct Prediction
+{
+	int id; // of the Node
+	double chance;
+};
+
+class Predictor
+{
+	public :
+	string name;
+	virtual ~Predictor() {}
+	/* next was opened after current, which was opened after previous ( -1 if there was none ) */
+	virtual void train( int previous, int current, int next ) = 0;
+	/* the likely next opens after node ( opened after previous ), most likely first */
+	virtual void predict( int previous, Node *node, vector<Prediction> &out ) = 0;
+};
+
+/* successor ids and how often they followed, most frequent first */
+struct SuccessorCounts
+{
+	vector< pair<int, int> > counts;
+	int total;
+
+	SuccessorCounts()
+	{ total = 0; }
+
+	void add( int id )
+	{
+		int i = 0;
+		while( i < counts.size() && counts[i].first != id )
+			i++;
+		if( i == counts.size() )
+			counts.push_back( make_pair( id, 0 ) );
+		counts[i].second++;
+		total++;
+		/* ties keep the order they reached that count, like the graph's windows */
+		while( i > 0 && counts[i-1].second < counts[i].second )
+		{
+			swap( counts[i-1], counts[i] );
+			i--;
+		}
+	}
+	void predict( vector<Prediction> &out )
+	{
+		for( int i = 0; i < counts.size(); i++ )
+		{
+			Prediction prediction;
+			prediction.id = counts[i].first;
+			prediction.chance = (double)counts[i].second/total;
+			out.push_back( prediction );
+		}
+	}
+};
+
+/* the association strengths of the Probability_Graph ( trained by the CallWindow ) */
+class GraphPredictor : public Predictor
+{
+	public :
+	GraphPredictor()
+	{ name = "graph"; }
+	void train( int previous, int current, int next )
+	{}
+	void predict( int previous, Node *node, vector<Prediction> &out )
+	{
+		for( int i = 0; i < node->window.size(); i++ )
+		{
+			Prediction prediction;
+			prediction.id = node->window[i].id;
+			prediction.chance = (double)node->window[i].strength/node->total_strength;
+			out.push_back( prediction );
+		}
+	}
+};
+
+/* whatever followed the node the last time */
+class LastSuccessorPredictor : public Predictor
+{
+	vector<int> last; // by node id, -1 before it was followed
+
+	public :
+	LastSuccessorPredictor()
+	{ name = "last successor"; }
+	void train( int previous, int current, int next )
+	{
+		if( current >= last.size() )
+			last.resize( current + 1, -1 );
+		last[current] = next;
+	}
+	void predict( int previous, Node *node, vector<Prediction> &out )
+	{
+		if( node->id >= last.size() || last[node->id] < 0 )
+			return;
+		Prediction prediction;
+		prediction.id = last[node->id];
+		prediction.chance = 1;
+		out.push_back( prediction );
+	}
+};
+
+/* whatever followed the node most often, right after it */
+class MostFrequentPredictor : public Predictor
+{
+	vector<SuccessorCounts> successors; // by node id
+
+	public :
+	MostFrequentPredictor()
+	{ name = "most frequent"; }
+	void train( int previous, int current, int next )
+	{
+		if( current >= successors.size() )
+			successors.resize( current + 1 );
+		successors[current].add( next );
+	}
+	void predict( int previous, Node *node, vector<Prediction> &out )
+	{
+		if( node->id < successors.size() )
+			successors[node->id].predict( out );
+	}
+};
+
+/* whatever followed the last two opens ( an order 2 context ) */
+class ContextPredictor : public Predictor
+{
+	map< pair<int, int>, SuccessorCounts > contexts;
+
+	public :
+	ContextPredictor()
+	{ name = "order 2 context"; }
+	void train( int previous, int current, int next )
+	{
+		if( previous >= 0 )
+			contexts[ make_pair( previous, current ) ].add( next );
+	}
+	void predict( int previous, Node *node, vector<Prediction> &out )
+	{
+		map< pair<int, int>, SuccessorCounts >::iterator it = contexts.find( make_pair( previous, node->id ) );
+		if( it != contexts.end() )
+			it->second.predict( out );
+	}
+};
+
+/* keeps each predictor's recent accuracy at every node, only the winner of a node predicts for it */
+class Tournament
+{
+	private :
+	vector<Predictor*> predictors; // the graph first, it holds every node until another predictor does better
+	struct Standing
+	{
+		vector<double> accuracy; // by predictor
+		int winner;
+	};
+	vector<Standing> standings; // by node id
+	int previous, current; // the last two opens, -1 if there was none
+
+	/* tournament owns the predictors, so it is not copied */
+	Tournament( const Tournament& );
+	Tournament& operator=( const Tournament& );
+
+	Standing& standingOf( int id )
+	{
+		if( id >= standings.size() )
+		{
+			Standing standing;
+			standing.accuracy.resize( predictors.size(), 0 );
+			standing.winner = 0;
+			standings.resize( id + 1, standing );
+		}
+		return standings[id];
+	}
+
+	public :
+	Tournament()
+	{
+		predictors.push_back( new GraphPredictor() );
+		predictors.push_back( new LastSuccessorPredictor() );
+		predictors.push_back( new MostFrequentPredictor() );
+		predictors.push_back( new ContextPredictor() );
+		previous = -1;
+		current = -1;
+	}
+	~Tournament()
+	{
+		for( int i = 0; i < predictors.size(); i++ )
+			delete predictors[i];
+	}
+
+	/* the open before the last one, the context of a prediction for the last one */
+	int previousOpen()
+	{ return previous; }
+
+	/* check what every predictor said would follow the last open, before any of them learns from next ( -1 : a new file ) */
+	void score( Node_Table &nodes, int next )
+	{
+		if( current < 0 )
+			return;
+		Standing &standing = standingOf( current );
+		vector<Prediction> predictions;
+		for( int i = 0; i < predictors.size(); i++ )
+		{
+			predictions.clear();
+			predictors[i]->predict( previous, &nodes[current], predictions );
+			bool hit = false;
+			for( int j = 0; j < predictions.size() && j < TOURNAMENT_TOP; j++ )
+				hit = hit || predictions[j].id == next;
+			standing.accuracy[i] = ( 1 - TOURNAMENT_DECAY )*standing.accuracy[i] + ( hit ? TOURNAMENT_DECAY : 0 );
+		}
+		/* a challenger has to be clearly better to take the node */
+		int best = standing.winner;
+		for( int i = 0; i < predictors.size(); i++ )
+			if( standing.accuracy[i] > standing.accuracy[best] )
+				best = i;
+		if( standing.accuracy[best] > standing.accuracy[standing.winner] + TOURNAMENT_MARGIN )
+			standing.winner = best;
+	}
+
+	/* next ( a node id, -1 if it is not known yet ) was opened */
+	void train( int next )
+	{
+		if( current >= 0 && next >= 0 )
+			for( int i = 0; i < predictors.size(); i++ )
+				predictors[i]->train( previous, current, next );
+		previous = current;
+		current = next;
+	}
+
+	/* index of the predictor that predicts for the node, 0 is the graph */
+	int winner( int id )
+	{ return id < standings.size() ? standings[id].winner : 0; }
+
+	/* the predictions of the node's winner, as likely as that predictor has been right there */
+	void predict( int previous_id, Node *node, vector<Prediction> &out )
+	{
+		Standing &standing = standingOf( node->id );
+		int first = out.size();
+		predictors[standing.winner]->predict( previous_id, node, out );
+		for( int i = first; i < out.size(); i++ )
+			out[i].chance *= standing.accuracy[standing.winner];
+	}
+
+	void report()
+	{
+		cout << "---------- Predictors ----------" << endl;
+		for( int i = 0; i < predictors.size(); i++ )
+		{
+			long won = 0;
+			double accuracy = 0;
+			for( int j = 0; j < standings.size(); j++ )
+			{
+				if( standings[j].winner == i )
+					won++;
+				accuracy += standings[j].accuracy[i];
+			}
+			cout << predictors[i]->name << " : Nodes Won : " << won;
+			if( standings.size() )
+				cout << " Mean Accuracy : " << accuracy/standings.size();
+			cout << endl;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,186 @@
+/* follows every prefetched block from its issue through its arrival to its first use or its eviction, and charges */
+/* the outcome to the node that predicted it : precision, coverage, timeliness, wasted bytes and cache pollution */
+#ifndef Prefetch_Analytics_H
+#define Prefetch_Analytics_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
+
+using namespace std;
+
+/* who pushed a block out of memory : a node id, or one of these */
+#define DISPLACED_BY_READAHEAD -1 // sequential read ahead predicts without a node
+#define DISPLACED_BY_GROWTH -2 // the prefetch buffer grew into the cache
+#define NOT_DISPLACED -3 // a demand access or a quota made the room
+
+/* sources printed in the report, most prefetched first */
+#define ANALYTICS_TOP_SOURCES 10
+
+class PrefetchAnalytics
+{
+	public :
+	typedef pair<string, int> Key; // file, block
+
+	struct SourceStats
+	{
+		long issued, used, late, wasted, polluted; // pages
+		long double lead; // seconds the used blocks were in memory before they were demanded ( negative when late )
+
+		SourceStats()
+		{
+			issued = 0;
+			used = 0;
+			late = 0;
+			wasted = 0;
+			polluted = 0;
+			lead = 0;
+		}
+	};
+
+	private :
+	struct Flight
+	{
+		int source;
+		long double ready; // when it arrives
+	};
+	/* prefetched blocks that were neither used nor evicted yet */
+	map<Key, Flight> flights;
+	map<int, SourceStats> sources;
+	/* blocks pushed out of memory by a prefetch, until they are demanded or forgotten ( oldest first ) */
+	map< Key, pair<int, long> > displaced; // -> who, sequence number
+	deque< pair<Key, long> > displaced_order;
+	long displaced_sequence;
+	long displaced_limit;
+	long demand_reads; // blocks read from the device or second tier on demand
+	long growth_pollution;
+
+	public :
+	PrefetchAnalytics()
+	{
+		displaced_sequence = 0;
+		displaced_limit = 0;
+		demand_reads = 0;
+		growth_pollution = 0;
+	}
+
+	/* remember at most that many displaced blocks ( the size of memory, like the ghost lists ) */
+	void setLimit( long pages )
+	{ displaced_limit = pages; }
+
+	/* a block entered the prefetch buffer, or was staged in the second tier */
+	void issued( const Key &key, int source, long double ready )
+	{
+		Flight flight;
+		flight.source = source;
+		flight.ready = ready;
+		flights[key] = flight;
+		sources[source].issued++;
+	}
+
+	/* a prefetched block was demanded at now */
+	void used( const Key &key, long double now )
+	{
+		map<Key, Flight>::iterator it = flights.find( key );
+		if( it == flights.end() )
+			return;
+		SourceStats &stats = sources[it->second.source];
+		stats.used++;
+		stats.lead += now - it->second.ready;
+		if( now < it->second.ready )
+			stats.late++;
+		flights.erase( it );
+	}
+
+	/* a block left the cache, the prefetch buffer or the second tier, to make room for a prefetch of displacer if there was one */
+	void evicted( const Key &key, int displacer )
+	{
+		map<Key, Flight>::iterator it = flights.find( key );
+		if( it != flights.end() )
+		{
+			sources[it->second.source].wasted++;
+			flights.erase( it );
+		}
+		if( displacer == NOT_DISPLACED || displaced_limit <= 0 )
+			return;
+		displaced[key] = make_pair( displacer, displaced_sequence );
+		displaced_order.push_back( make_pair( key, displaced_sequence++ ) );
+		while( (long)displaced_order.size() > displaced_limit )
+		{
+			map< Key, pair<int, long> >::iterator old = displaced.find( displaced_order.front().first );
+			if( old != displaced.end() && old->second.second == displaced_order.front().second )
+				displaced.erase( old );
+			displaced_order.pop_front();
+		}
+	}
+
+	/* a block that was not in memory was read on demand */
+	void demandRead( const Key &key )
+	{
+		demand_reads++;
+		map< Key, pair<int, long> >::iterator it = displaced.find( key );
+		if( it == displaced.end() )
+			return;
+		if( it->second.first == DISPLACED_BY_GROWTH )
+			growth_pollution++;
+		else
+			sources[it->second.first].polluted++;
+		displaced.erase( it );
+	}
+
+	/* names : the file of each node id */
+	void report( long block_size, const vector<string> &names )
+	{
+		SourceStats total;
+		for( map<int, SourceStats>::iterator it = sources.begin(); it != sources.end(); it++ )
+		{
+			total.issued += it->second.issued;
+			total.used += it->second.used;
+			total.late += it->second.late;
+			total.wasted += it->second.wasted;
+			total.polluted += it->second.polluted;
+			total.lead += it->second.lead;
+		}
+		if( !total.issued )
+			return;
+		cout << "---------- Prefetch Effectiveness ----------" << endl;
+		cout << "Prefetched Blocks : " << total.issued << " Used : " << total.used << " Late : " << total.late;
+		cout << " Wasted : " << total.wasted << " ( " << total.wasted*block_size << " bytes ) Still Buffered : " << flights.size() << endl;
+		cout << "Precision : " << (double)total.used/total.issued;
+		if( total.used + demand_reads )
+			cout << " Coverage : " << (double)total.used/( total.used + demand_reads );
+		if( total.used )
+			cout << " Mean Lead Time (us) : " << (double)( total.lead/total.used*1000000 );
+		cout << endl;
+		cout << "Pollution : " << total.polluted + growth_pollution << " blocks demanded after a prefetch pushed them out";
+		cout << " ( " << growth_pollution << " by the prefetch buffer growing )" << endl;
+
+		/* the sources that prefetched the most */
+		vector< pair<long, int> > order;
+		for( map<int, SourceStats>::iterator it = sources.begin(); it != sources.end(); it++ )
+			order.push_back( make_pair( -it->second.issued, it->first ) );
+		sort( order.begin(), order.end() );
+		for( int i = 0; i < order.size() && i < ANALYTICS_TOP_SOURCES; i++ )
+		{
+			int id = order[i].second;
+			SourceStats &stats = sources[id];
+			if( id == DISPLACED_BY_READAHEAD )
+				cout << "read ahead";
+			else if( id >= 0 && id < names.size() )
+				cout << names[id];
+			else
+				cout << "node " << id;
+			cout << " : issued " << stats.issued << " precision " << (double)stats.used/stats.issued;
+			if( total.used + demand_reads )
+				cout << " coverage " << (double)stats.used/( total.used + demand_reads );
+			if( stats.used )
+				cout << " lead (us) " << (double)( stats.lead/stats.used*1000000 ) << " late " << stats.late;
+			cout << " wasted " << stats.wasted*block_size << " bytes polluted " << stats.polluted << endl;
+		}
+	}
+};
+
+#endif
@@ -9,17 +9,56 @@
 #include <set>
 #include <stdlib.h>
 #include <utility>
+#include <map>
+#include <memory>
+#include <algorithm>
 #include "Driver.h"
+#include "Object_Pool.h"
 #include <iomanip>
+#include <fstream>
 
 using namespace std;
 
 /***** STRUCTURES *********/
 
+/* a set of dense Node ids stored as a bitset */
+struct NodeSet
+{
+	vector<unsigned long long> bits;
+
+	void insert( int id )
+	{
+		if( id/64 >= bits.size() )
+			bits.resize( id/64 + 1, 0 );
+		bits[id/64] |= 1ULL << (id%64);
+	}
+	bool contains( int id ) const
+	{
+		return id/64 < bits.size() && ( ( bits[id/64] >> (id%64) ) & 1 );
+	}
+	int size() const
+	{
+		int count = 0;
+		for( int i = 0; i < bits.size(); i++ )
+			count += __builtin_popcountll( bits[i] );
+		return count;
+	}
+	/* number of ids in both sets */
+	int count_common( const NodeSet &other ) const
+	{
+		int count = 0;
+		int words = bits.size() < other.bits.size() ? bits.size() : other.bits.size();
+		for( int i = 0; i < words; i++ )
+			count += __builtin_popcountll( bits[i] & other.bits[i] );
+		return count;
+	}
+};
+
 struct Association
 {
 
 	SystemCall *call;
+	int id; // id of the Node for this call
 	int strength;
 
 };
@@ -28,11 +67,154 @@ struct Node
 {
 	/* a set of calls made at different times */
 	SystemCall *call;
-	vector<Association> window; //possible options in the lookahead period
+	int id; // index into Probability_Graph::nodes
+	vector<Association> window; //possible options in the lookahead period ( strongest first )
+	NodeSet successors; // ids of every Node in the window
 	int total_strength;
 };
 /************************/
 
+#define NODE_CHUNK_SIZE 256 // nodes per chunk of a Node_Table
+
+/* Nodes by id, each in its own allocation so it is never moved. a copy of the table shares every Node ( and chunk ) */
+/* with it, so a snapshot costs a pointer per chunk plus a copy of each Node that changed since the one before it */
+class Node_Table
+{
+
+	private :
+	struct Chunk
+	{
+		shared_ptr<Node> nodes[NODE_CHUNK_SIZE];
+	};
+	vector< shared_ptr<Chunk> > chunks;
+	long count;
+
+	public :
+	Node_Table()
+	{ count = 0; }
+
+	/* a new Node at the end of a table that is not shared */
+	Node* allocate()
+	{
+		if( count == (long)chunks.size()*NODE_CHUNK_SIZE )
+			chunks.push_back( make_shared<Chunk>() );
+		shared_ptr<Node> &slot = chunks.back()->nodes[count%NODE_CHUNK_SIZE];
+		slot = make_shared<Node>();
+		count++;
+		return slot.get();
+	}
+
+	Node& operator[]( long i )
+	{ return *chunks[i/NODE_CHUNK_SIZE]->nodes[i%NODE_CHUNK_SIZE]; }
+	const Node& operator[]( long i ) const
+	{ return *chunks[i/NODE_CHUNK_SIZE]->nodes[i%NODE_CHUNK_SIZE]; }
+	long size() const
+	{ return count; }
+
+	/* copy the Nodes with the given ids ( increasing ) from another table and take its size, the rest stay shared. */
+	/* a chunk is copied before it is written, since the tables that share it may still be read */
+	void update( const Node_Table &from, const vector<int> &ids )
+	{
+		long copied = -1;
+		for( int i = 0; i < ids.size(); i++ )
+		{
+			long chunk = ids[i]/NODE_CHUNK_SIZE;
+			if( chunk != copied )
+			{
+				if( chunk < chunks.size() )
+					chunks[chunk] = make_shared<Chunk>( *chunks[chunk] );
+				while( chunk >= chunks.size() )
+					chunks.push_back( make_shared<Chunk>() );
+				copied = chunk;
+			}
+			chunks[chunk]->nodes[ids[i]%NODE_CHUNK_SIZE] = make_shared<Node>( from[ids[i]] );
+		}
+		count = from.count;
+	}
+};
+
+#define INDEX_CHUNK_SIZE 256 // buckets per chunk of a Name_Index
+
+/* file name -> Node id as a hash table that is never changed in place, so a snapshot reads it without a lock. */
+/* like a Node_Table, a copy shares every chunk and bucket with it until they are replaced */
+class Name_Index
+{
+
+	private :
+	typedef vector< pair<string, int> > Bucket;
+	struct Chunk
+	{
+		shared_ptr<const Bucket> buckets[INDEX_CHUNK_SIZE];
+	};
+	vector< shared_ptr<Chunk> > chunks;
+	long count;
+
+	/* the number of buckets is a power of 2 */
+	size_t bucketOf( const string &name ) const
+	{ return hash<string>()( name ) & ( chunks.size()*INDEX_CHUNK_SIZE - 1 ); }
+
+	public :
+	Name_Index()
+	{ count = 0; }
+
+	/* the id for a name, -1 if it is not in the index */
+	int find( const string &name ) const
+	{
+		if( chunks.empty() )
+			return -1;
+		size_t i = bucketOf( name );
+		const Bucket *bucket = chunks[i/INDEX_CHUNK_SIZE]->buckets[i%INDEX_CHUNK_SIZE].get();
+		if( bucket )
+			for( int j = 0; j < bucket->size(); j++ )
+				if( (*bucket)[j].first == name )
+					return (*bucket)[j].second;
+		return -1;
+	}
+
+	/* add names that are not in the index yet. the touched chunks and buckets are copied, the rest stay shared, */
+	/* and the table is rebuilt with twice the buckets once it holds more names than buckets */
+	void add( const vector< pair<string, int> > &entries )
+	{
+		if( entries.empty() )
+			return;
+		vector< pair<string, int> > all;
+		long buckets = (long)chunks.size()*INDEX_CHUNK_SIZE;
+		if( count + (long)entries.size() > buckets )
+		{
+			for( int c = 0; c < chunks.size(); c++ )
+				for( int b = 0; b < INDEX_CHUNK_SIZE; b++ )
+					if( chunks[c]->buckets[b] )
+						all.insert( all.end(), chunks[c]->buckets[b]->begin(), chunks[c]->buckets[b]->end() );
+			if( buckets == 0 )
+				buckets = INDEX_CHUNK_SIZE;
+			while( buckets < count + (long)entries.size() )
+				buckets *= 2;
+			chunks.clear();
+			for( long c = 0; c < buckets/INDEX_CHUNK_SIZE; c++ )
+				chunks.push_back( make_shared<Chunk>() );
+			count = 0;
+		}
+		all.insert( all.end(), entries.begin(), entries.end() );
+
+		/* a chunk that is shared is copied once, before its first bucket is replaced */
+		vector<bool> copied( chunks.size(), false );
+		for( int i = 0; i < all.size(); i++ )
+		{
+			size_t b = bucketOf( all[i].first );
+			long c = b/INDEX_CHUNK_SIZE;
+			if( !copied[c] )
+			{
+				chunks[c] = make_shared<Chunk>( *chunks[c] );
+				copied[c] = true;
+			}
+			shared_ptr<const Bucket> &slot = chunks[c]->buckets[b%INDEX_CHUNK_SIZE];
+			shared_ptr<Bucket> bucket = slot ? make_shared<Bucket>( *slot ) : make_shared<Bucket>();
+			bucket->push_back( all[i] );
+			slot = bucket;
+			count++;
+		}
+	}
+};
 
 /***** COMPARISONS *****/
 struct nodeComparison {
@@ -52,8 +234,25 @@ class Probability_Graph
 	int lookaheadWindow;
 	int  size;
 
+	/* file name -> Node id, only used by the thread that changes the graph */
+	map<string, int> index;
+	/* file name -> Node id for the nodes of the last snapshot, shared with it */
+	Name_Index names;
+	/* a snapshot looks up names in its own index */
+	bool is_snapshot;
+	/* the calls of the nodes of a loaded graph */
+	Object_Pool<SystemCall> records;
+	/* the nodes of the last snapshot, and the ids of the nodes changed since it ( once there is one ) */
+	Node_Table published;
+	bool publishing;
+	vector<int> dirty;
+	vector<bool> changed;
+
+	/* a Node is different from the one in the last snapshot */
+	void mark( int );
+
 	public :
-	vector<Node> nodes;
+	Node_Table nodes; // indexed by Node id, never moved
 	/* default constructor */
 	Probability_Graph();
 	/* constructor with a vector of SystemCalls */
@@ -61,43 +260,83 @@ class Probability_Graph
 	
 	/* create a set of nodes [nodeSet] and their respective associations */
 	void remove_dups( vector<Node>& );
-	void remove_dups( vector<Association>& );
+
+	/* strengthen the arc from one Node to another */
+	void strengthen( Node*, Node* );
 
 	/* to find a Node in the graph */
 	Node* find(SystemCall*);
+	/* to add a Node for a SystemCall that is not in the graph yet */
+	Node* add(SystemCall*);
+	/* keep the data from the latest SystemCall for a Node */
+	void setCall( Node*, SystemCall* );
+
+	/* a copy ( same Node ids ) that stays the same while this graph keeps learning, it shares every Node */
+	/* that did not change since the last snapshot with it. only the thread that changes the graph takes them */
+	Probability_Graph* snapshot();
+
+	/* write the graph to a file, read it into an empty graph ( false if the file cannot be used ) */
+	bool save(string);
+	bool load(string);
 
 	
 };
 /* constructor */
 Probability_Graph::Probability_Graph()
 {
+	publishing = false;
+	is_snapshot = false;
 }
 Probability_Graph::Probability_Graph(int tmp2)
 {
 	lookaheadWindow = tmp2;
+	publishing = false;
+	is_snapshot = false;
 }
-/* remove duplicate associations and strengthen arcs as needed */
-void Probability_Graph::remove_dups (vector<Association>& v) 
+void Probability_Graph::mark( int id )
 {
-    
-    if( !v.empty() )
-    {
-    	for( int i = 0; i < v.size() - 1; i++)
-    	{	
-		for( vector<Association>::iterator it = v.begin() + i + 1 ; it != v.end(); it++)
-		{
-			if( (*v.at(i).call) == (*(*it).call)   )
-			{
-				vector<Association>::iterator del = v.begin()+i;
-				(*it).strength += (*del).strength;
-				v.erase( del );
-				if( i > 0 )
-					i--;
-				break;
-			}	
-		}	
-    	}
-    }
+	if( !publishing )
+		return;
+	if( id >= changed.size() )
+		changed.resize( id + 1, false );
+	if( !changed[id] )
+	{
+		changed[id] = true;
+		dirty.push_back( id );
+	}
+}
+/* strengthen an arc ( or create it ) and keep the window sorted by strength, strongest first */
+/* ties stay in the order they reached that strength, so the most recently strengthened arc is last */
+void Probability_Graph::strengthen( Node *node, Node *target )
+{
+	vector<Association> &v = node->window;
+	int i = 0;
+	if( node->successors.contains( target->id ) )
+	{
+		while( v[i].id != target->id )
+			i++;
+	}
+	else
+	{
+		Association assoc;
+		assoc.id = target->id;
+		assoc.strength = 0;
+		i = v.size();
+		v.push_back( assoc );
+		node->successors.insert( target->id );
+	}
+	mark( node->id );
+	/* keep the data from the latest System Call */
+	v[i].call = target->call;
+	v[i].strength++;
+	node->total_strength++;
+
+	/* move it ahead of every weaker association */
+	while( i > 0 && v[i-1].strength < v[i].strength )
+	{
+		swap( v[i-1], v[i] );
+		i--;
+	}
 }
 
 /* Precondition : the vector of Nodes are ordered temporally ( least to greatest ) to the microSecond */
@@ -128,16 +367,129 @@ void Probability_Graph::remove_dups (vector<Node>& v)
 }
 /* Precondition : will only find Nodes that are 'open' calls */
 Node* Probability_Graph::find ( SystemCall *file) {
-	Node *ptr = NULL;
-	
-	/* iterate through the set of Nodes to see if this one is present */
-	for( int i = 0; i < nodes.size(); i++ )
+	if( file->callType != "open" )
+		return NULL;
+
+	if( is_snapshot )
+	{
+		int id = names.find( file->file );
+		return id < 0 ? NULL : &nodes[id];
+	}
+	map<string, int>::iterator it = index.find( file->file );
+	if( it == index.end() )
+		return NULL;
+	return &nodes[it->second];
+}
+
+Probability_Graph* Probability_Graph::snapshot()
+{
+	/* the first snapshot copies every node */
+	if( !publishing )
 	{
-		if( (*nodes.at(i).call) == *file ) // only works for open calls
-			ptr = &nodes.at(i);
-	}	
-	/* otherwise return NULL */
+		for( int i = 0; i < nodes.size(); i++ )
+			dirty.push_back( i );
+		publishing = true;
+	}
+	/* the nodes added since the last snapshot */
+	vector< pair<string, int> > added;
+	for( long i = published.size(); i < nodes.size(); i++ )
+		added.push_back( make_pair( nodes[i].call->file, (int)i ) );
+	names.add( added );
+	sort( dirty.begin(), dirty.end() );
+	published.update( nodes, dirty );
+	for( int i = 0; i < dirty.size(); i++ )
+		if( dirty[i] < changed.size() )
+			changed[ dirty[i] ] = false;
+	dirty.clear();
+
+	Probability_Graph *copy = new Probability_Graph( lookaheadWindow );
+	copy->names = names;
+	copy->is_snapshot = true;
+	copy->nodes = published;
+	return copy;
+}
+
+/* line 1 : graph [lookahead window] [nodes], then a [bytes] [file] line for every node in id order, */
+/* then a [associations] [id] [strength] [id] [strength] ... line for every node ( strongest first ) */
+bool Probability_Graph::save( string path )
+{
+	ofstream out( path.c_str() );
+	if( !out )
+		return false;
+	out << "graph " << lookaheadWindow << " " << nodes.size() << "\n";
+	for( long i = 0; i < nodes.size(); i++ )
+		out << nodes[i].call->bytes << " " << nodes[i].call->file << "\n";
+	for( long i = 0; i < nodes.size(); i++ )
+	{
+		vector<Association> &v = nodes[i].window;
+		out << v.size();
+		for( int j = 0; j < v.size(); j++ )
+			out << " " << v[j].id << " " << v[j].strength;
+		out << "\n";
+	}
+	return out.good();
+}
 
-	return ptr;
+bool Probability_Graph::load( string path )
+{
+	ifstream in( path.c_str() );
+	string word;
+	int window;
+	long count;
+	if( !( in >> word >> window >> count ) || word != "graph" || nodes.size() )
+		return false;
+	if( window != lookaheadWindow )
+		cout << "Warning: " << path << " was built with a lookahead window of " << window << endl;
+
+	SystemCall call;
+	call.callType = "open";
+	call.streamID = 0;
+	call.hourTime = call.minuteTime = call.secondTime = 0;
+	call.microSecondTime = 0;
+	call.offset = 0;
+	call.pid = 0;
+	for( long i = 0; i < count; i++ )
+	{
+		if( !( in >> call.bytes ) )
+			return false;
+		in.get();
+		getline( in, call.file );
+		add( records.push_back( call ) );
+	}
+	for( long i = 0; i < count; i++ )
+	{
+		Node &node = nodes[i];
+		int size;
+		if( !( in >> size ) )
+			return false;
+		node.window.resize( size );
+		for( int j = 0; j < size; j++ )
+		{
+			Association &assoc = node.window[j];
+			if( !( in >> assoc.id >> assoc.strength ) || assoc.id < 0 || assoc.id >= count )
+				return false;
+			assoc.call = nodes[assoc.id].call;
+			node.successors.insert( assoc.id );
+			node.total_strength += assoc.strength;
+		}
+	}
+	return true;
+}
+
+/* Precondition : find() returned NULL for this 'open' call */
+Node* Probability_Graph::add ( SystemCall *file) {
+	Node *node = nodes.allocate();
+	node->call = file;
+	node->id = nodes.size() - 1;
+	node->total_strength = 0;
+	mark( node->id );
+	index[file->file] = node->id;
+	return node;
+}
+
+void Probability_Graph::setCall( Node *node, SystemCall *file )
+{
+	mark( node->id );
+	node->call = file;
 }
 #endif
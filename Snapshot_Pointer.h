@@ -0,0 +1,97 @@
+/* read-copy-update publication of an object that is read far more often than it changes : the writer publishes */
+/* a new copy, readers use the latest one without locks, and a replaced copy is deleted once no reader can still use it */
+/* ( epoch based reclamation : a reader announces the epoch it entered in, a copy replaced in an earlier epoch is unreachable ) */
+#ifndef Snapshot_Pointer_H
+#define Snapshot_Pointer_H
+
+#include <atomic>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+#define SNAPSHOT_MAX_READERS 64 // threads that can read the snapshots
+
+template <class T>
+class Snapshot_Pointer
+{
+
+	private :
+	atomic<T*> current;
+	atomic<unsigned long> epoch; // starts at 1, 0 marks a reader that is outside
+	atomic<unsigned long> readers[SNAPSHOT_MAX_READERS];
+	atomic<int> reader_count;
+	/* replaced copies and the epoch they were replaced in ( only the writer uses it ) */
+	vector< pair<T*, unsigned long> > retired;
+
+	/* snapshots are owned, so they are not copied */
+	Snapshot_Pointer( const Snapshot_Pointer& );
+	Snapshot_Pointer& operator=( const Snapshot_Pointer& );
+
+	public :
+	Snapshot_Pointer()
+	{
+		current = NULL;
+		epoch = 1;
+		reader_count = 0;
+		for( int i = 0; i < SNAPSHOT_MAX_READERS; i++ )
+			readers[i] = 0;
+	}
+	~Snapshot_Pointer()
+	{
+		for( int i = 0; i < retired.size(); i++ )
+			delete retired[i].first;
+		delete current.load();
+	}
+
+	/* a slot for a reading thread, -1 if there are too many */
+	int registerReader()
+	{
+		int reader = reader_count++;
+		return reader < SNAPSHOT_MAX_READERS ? reader : -1;
+	}
+
+	/* the latest copy, it stays valid until exit() */
+	T* enter( int reader )
+	{
+		readers[reader] = epoch.load();
+		return current.load();
+	}
+	void exit( int reader )
+	{
+		readers[reader] = 0;
+	}
+
+	/* writer : make next the latest copy, the ones no reader can see any more are deleted */
+	void publish( T *next )
+	{
+		T *old = current.exchange( next );
+		if( old != NULL )
+			retired.push_back( make_pair( old, epoch.fetch_add( 1 ) ) );
+		reclaim();
+	}
+
+	void reclaim()
+	{
+		/* the oldest epoch a reader is still in */
+		unsigned long oldest = epoch.load();
+		int count = reader_count < SNAPSHOT_MAX_READERS ? reader_count.load() : SNAPSHOT_MAX_READERS;
+		for( int i = 0; i < count; i++ )
+		{
+			unsigned long entered = readers[i];
+			if( entered && entered < oldest )
+				oldest = entered;
+		}
+		int kept = 0;
+		for( int i = 0; i < retired.size(); i++ )
+		{
+			if( retired[i].second < oldest )
+				delete retired[i].first;
+			else
+				retired[kept++] = retired[i];
+		}
+		retired.resize( kept );
+	}
+};
+
+#endif
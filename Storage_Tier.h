@@ -0,0 +1,125 @@
+/* a slower, larger cache between the memory cache and the disk ( e.g. a local SSD in front of network storage ) */
+/* blocks that are read from the disk are kept here as well, prefetches can be staged here instead of in memory */
+#ifndef Storage_Tier_H
+#define Storage_Tier_H
+
+#include <iostream>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include "Disk_Model.h"
+
+using namespace std;
+
+class Storage_Tier
+{
+	public :
+	typedef pair<string, int> Key; // file, block
+
+	private :
+	struct Entry
+	{
+		Key key;
+		long double ready; // when the block is in the tier
+		int staged; // id of the node that predicted it until it is read, else -1
+	};
+	list<Entry> order; // eviction order, front goes first
+	map< Key, list<Entry>::iterator > index;
+	bool lru; // else fifo
+
+	public :
+	string name;
+	long capacity; // pages, 0 : no tier
+	Disk_Model device;
+	/* statistics in pages */
+	long hits, misses, staged, staged_used;
+
+	Storage_Tier()
+	{
+		name = "ssd";
+		capacity = 0;
+		lru = true;
+		hits = 0;
+		misses = 0;
+		staged = 0;
+		staged_used = 0;
+	}
+
+	void configure( long pages, DeviceProfile profile, string policy )
+	{
+		capacity = pages;
+		device = Disk_Model( profile );
+		lru = ( policy != "fifo" );
+	}
+	bool enabled()
+	{ return capacity > 0; }
+
+	bool contains( const Key &key )
+	{ return index.count( key ); }
+
+	/* when the block is ( or will be ) in the tier, -1 if it is not there. counts a hit or a miss */
+	/* source : the node that predicted it, if this is the first read of a staged prefetch */
+	long double find( const Key &key, int *source = NULL )
+	{
+		map< Key, list<Entry>::iterator >::iterator it = index.find( key );
+		if( it == index.end() )
+		{
+			misses++;
+			return -1;
+		}
+		hits++;
+		if( it->second->staged >= 0 ) {
+			staged_used++;
+			if( source )
+				*source = it->second->staged;
+			it->second->staged = -1;
+		}
+		long double ready = it->second->ready;
+		if( lru )
+			order.splice( order.end(), order, it->second );
+		return ready;
+	}
+
+	/* source : the node that predicted a staged prefetch, -1 for a block read on demand. false if the block was there already */
+	/* dropped : gets the staged prefetches that were pushed out before they were read */
+	bool insert( const Key &key, long double ready, int source, vector<Key> *dropped = NULL )
+	{
+		map< Key, list<Entry>::iterator >::iterator it = index.find( key );
+		if( it != index.end() )
+		{
+			if( ready < it->second->ready )
+				it->second->ready = ready;
+			return false;
+		}
+		Entry entry;
+		entry.key = key;
+		entry.ready = ready;
+		entry.staged = source;
+		if( source >= 0 )
+			staged++;
+		order.push_back( entry );
+		index[key] = --order.end();
+		while( (long)order.size() > capacity ) {
+			if( dropped && order.front().staged >= 0 )
+				dropped->push_back( order.front().key );
+			index.erase( order.front().key );
+			order.pop_front();
+		}
+		return true;
+	}
+
+	void report( long block_size )
+	{
+		cout << "---------- Tier : " << name << " ( " << capacity << " pages, " << ( lru ? "lru" : "fifo" ) << " ) ----------" << endl;
+		cout << "Tier Hits : " << hits << " Misses : " << misses;
+		if( hits + misses )
+			cout << " Hit Ratio : " << (double)hits/( hits + misses );
+		cout << endl;
+		if( staged )
+			cout << "Staged Prefetch Pages : " << staged << " Used : " << staged_used << endl;
+		device.report();
+	}
+};
+
+#endif
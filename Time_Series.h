@@ -0,0 +1,184 @@
+/* samples of the buffers every so much simulated ( trace ) time, written as CSV by a background thread : the request */
+/* path only copies a sample into a preallocated ring, the flush thread turns the counters into per interval deltas */
+#ifndef Time_Series_H
+#define Time_Series_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using namespace std;
+
+#define TIME_SERIES_CAPACITY 4096 // samples the ring holds, later ones are dropped until the flush thread catches up
+#define TIME_SERIES_FLUSH 0.1 // seconds between flushes
+
+struct TimeSample
+{
+	long long time; // trace microseconds, never decreasing
+	long cache_capacity, prefetch_capacity; // pages
+	double cache_ratio, prefetch_ratio; // weighted moving hit ratios
+	/* running totals, written as the change since the sample before */
+	long cache_hits, cache_misses, prefetch_hits, prefetch_misses;
+	long prefetches, accesses;
+};
+
+class Time_Series
+{
+
+	private :
+	vector<TimeSample> ring;
+	atomic<long> head, tail; // samples recorded, samples written
+	long dropped;
+	/* simulated time */
+	long long interval, next, day_offset, last_time, start;
+	/* flush thread */
+	ofstream out;
+	thread worker;
+	mutex lock;
+	condition_variable waiting;
+	bool stopping;
+	TimeSample previous;
+	bool written;
+
+	void run()
+	{
+		unique_lock<mutex> guard( lock );
+		while( true )
+		{
+			guard.unlock();
+			flush();
+			guard.lock();
+			if( stopping )
+				break;
+			waiting.wait_for( guard, chrono::microseconds( (long)( TIME_SERIES_FLUSH*1000000 ) ) );
+		}
+		guard.unlock();
+		flush();
+	}
+
+	/* write what was recorded since the last flush */
+	void flush()
+	{
+		long end = head.load( memory_order_acquire );
+		long t = tail.load( memory_order_relaxed );
+		if( t == end )
+			return;
+		for( ; t < end; t++ )
+		{
+			TimeSample &sample = ring[ t % TIME_SERIES_CAPACITY ];
+			if( !written )
+			{
+				previous = sample;
+				previous.cache_hits = previous.cache_misses = previous.prefetch_hits = previous.prefetch_misses = 0;
+				previous.prefetches = previous.accesses = 0;
+				written = true;
+			}
+			out << (double)( sample.time - start )/1000000 << "," << sample.cache_capacity << "," << sample.prefetch_capacity << ",";
+			out << sample.cache_ratio << "," << sample.prefetch_ratio << ",";
+			out << sample.cache_hits - previous.cache_hits << "," << sample.cache_misses - previous.cache_misses << ",";
+			out << sample.prefetch_hits - previous.prefetch_hits << "," << sample.prefetch_misses - previous.prefetch_misses << ",";
+			out << sample.prefetches - previous.prefetches << "," << sample.accesses - previous.accesses << "\n";
+			previous = sample;
+		}
+		tail.store( end, memory_order_release );
+		out.flush();
+	}
+
+	/* the series is owned by its thread, so it is not copied */
+	Time_Series( const Time_Series& );
+	Time_Series& operator=( const Time_Series& );
+
+	public :
+	Time_Series()
+	{
+		head = 0;
+		tail = 0;
+		dropped = 0;
+		interval = 0;
+		next = 0;
+		day_offset = 0;
+		last_time = 0;
+		start = -1;
+		stopping = false;
+		written = false;
+	}
+	~Time_Series()
+	{ stop(); }
+
+	/* sample every interval microseconds of trace time into a new file, false if it cannot be written */
+	bool open( string path, long long sample_interval )
+	{
+		out.open( path.c_str(), ios_base::out | ios_base::trunc );
+		if( !out.is_open() )
+			return false;
+		out << "time_s,cache_capacity,prefetch_capacity,cache_hit_ratio,prefetch_hit_ratio,";
+		out << "cache_hits_delta,cache_misses_delta,prefetch_hits_delta,prefetch_misses_delta,prefetches_delta,accesses_delta\n";
+		ring.resize( TIME_SERIES_CAPACITY );
+		interval = sample_interval > 0 ? sample_interval : 1;
+		worker = thread( &Time_Series::run, this );
+		return true;
+	}
+	bool enabled()
+	{ return interval > 0; }
+
+	/* the time of a call ( microseconds of the day ), true when a sample is due. the trace may pass midnight */
+	bool due( long long call_time )
+	{
+		if( !interval )
+			return false;
+		long long time = call_time + day_offset;
+		if( time < last_time && last_time - time > 43200000000LL )
+		{
+			day_offset += 86400000000LL;
+			time += 86400000000LL;
+		}
+		if( time > last_time )
+			last_time = time;
+		if( start < 0 )
+			start = next = last_time;
+		return last_time >= next;
+	}
+
+	/* a due sample ( its time is filled in ) */
+	void record( TimeSample &sample )
+	{
+		sample.time = last_time;
+		next = last_time - ( last_time - start ) % interval + interval;
+		long h = head.load( memory_order_relaxed );
+		if( h - tail.load( memory_order_acquire ) >= TIME_SERIES_CAPACITY )
+		{
+			dropped++;
+			return;
+		}
+		ring[ h % TIME_SERIES_CAPACITY ] = sample;
+		head.store( h + 1, memory_order_release );
+		if( h - tail.load( memory_order_relaxed ) >= TIME_SERIES_CAPACITY/2 )
+			waiting.notify_one();
+	}
+
+	/* write everything and end the flush thread */
+	void stop()
+	{
+		if( !worker.joinable() )
+			return;
+		{
+			unique_lock<mutex> guard( lock );
+			stopping = true;
+		}
+		waiting.notify_one();
+		worker.join();
+		out.close();
+	}
+
+	long samples()
+	{ return head.load(); }
+	long droppedSamples()
+	{ return dropped; }
+};
+
+#endif
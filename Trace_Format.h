@@ -0,0 +1,395 @@
+/* compact binary trace format : a header, a string table and one column per SystemCall field */
+/* columns are unsigned LEB128 varints : string ids for the call type, file and program, zigzag deltas for times, stream IDs, */
+/* bytes and pids */
+/* a BinaryTrace maps the file and decodes the columns as records are requested, so loading does no parsing */
+#ifndef Trace_Format_H
+#define Trace_Format_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Driver.h"
+#include "Object_Pool.h"
+
+using namespace std;
+
+#define TRACE_MAGIC "HPPT"
+#define TRACE_VERSION 2 // 2 : the pid and program columns
+
+/* column order in the file */
+enum TraceColumn { COLUMN_TYPES, COLUMN_FILES, COLUMN_TIMES, COLUMN_STREAMS, COLUMN_BYTES, COLUMN_PIDS, COLUMN_PROGRAMS, TRACE_COLUMNS };
+
+struct TraceHeader
+{
+	char magic[4];
+	unsigned int version;
+	unsigned long long record_count;
+	unsigned long long string_count;
+	/* the string table : string_count + 1 offsets ( unsigned int ) into the characters that follow them */
+	unsigned long long strings_offset;
+	/* byte offset and length of each column */
+	unsigned long long column_offset[TRACE_COLUMNS];
+	unsigned long long column_bytes[TRACE_COLUMNS];
+};
+
+/***** VARINTS *****/
+void putVarint( vector<unsigned char> &out, unsigned long long value )
+{
+	while( value >= 0x80 )
+	{
+		out.push_back( (unsigned char)( value | 0x80 ) );
+		value >>= 7;
+	}
+	out.push_back( (unsigned char)value );
+}
+
+/* a varint that has to end before end, false if it does not ( or is too long for 64 bits ) */
+bool getVarint( const unsigned char *&in, const unsigned char *end, unsigned long long &value )
+{
+	value = 0;
+	for( int shift = 0; in < end && shift < 64; shift += 7 )
+	{
+		value |= (unsigned long long)( *in & 0x7f ) << shift;
+		if( !( *in++ & 0x80 ) )
+			return true;
+	}
+	return false;
+}
+
+/* signed deltas are stored so that small negative values stay small */
+unsigned long long zigzag( long long value )
+{ return ( (unsigned long long)value << 1 ) ^ (unsigned long long)( value >> 63 ); }
+long long unzigzag( unsigned long long value )
+{ return (long long)( value >> 1 ) ^ -(long long)( value & 1 ); }
+/*******************/
+
+/* does the file start with the binary trace magic */
+bool isBinaryTrace( string path )
+{
+	char magic[4] = { 0 };
+	FILE *in = fopen( path.c_str(), "rb" );
+	if( in == NULL )
+		return false;
+	int count = fread( magic, 1, 4, in );
+	fclose( in );
+	return count == 4 && memcmp( magic, TRACE_MAGIC, 4 ) == 0;
+}
+
+/* builds the columns in memory and writes the file at the end */
+class TraceWriter
+{
+
+	private :
+	map<string, unsigned int> ids;
+	vector<string> strings;
+	vector<unsigned char> columns[TRACE_COLUMNS];
+	unsigned long long record_count;
+	/* for the deltas */
+	long long last_time, last_stream, last_bytes, last_pid, day_offset;
+
+	unsigned int stringId( const string& );
+
+	public :
+	TraceWriter();
+	void add( const SystemCall& );
+	bool write( string );
+};
+
+TraceWriter::TraceWriter()
+{
+	record_count = 0;
+	last_time = 0;
+	last_stream = 0;
+	last_bytes = 0;
+	last_pid = 0;
+	day_offset = 0;
+}
+
+unsigned int TraceWriter::stringId( const string &value )
+{
+	map<string, unsigned int>::iterator it = ids.find( value );
+	if( it != ids.end() )
+		return it->second;
+	ids[value] = strings.size();
+	strings.push_back( value );
+	return strings.size() - 1;
+}
+
+void TraceWriter::add( const SystemCall &call )
+{
+	/* times are kept increasing past midnight */
+	long long time = microseconds( call ) + day_offset;
+	if( record_count && last_time - time > 43200000000LL )
+	{
+		day_offset += 86400000000LL;
+		time += 86400000000LL;
+	}
+
+	putVarint( columns[COLUMN_TYPES], stringId( call.callType ) );
+	putVarint( columns[COLUMN_FILES], stringId( call.file ) );
+	putVarint( columns[COLUMN_TIMES], zigzag( time - last_time ) );
+	putVarint( columns[COLUMN_STREAMS], zigzag( call.streamID - last_stream ) );
+	putVarint( columns[COLUMN_BYTES], zigzag( call.bytes - last_bytes ) );
+	putVarint( columns[COLUMN_PIDS], zigzag( call.pid - last_pid ) );
+	putVarint( columns[COLUMN_PROGRAMS], stringId( call.program ) );
+	last_time = time;
+	last_stream = call.streamID;
+	last_bytes = call.bytes;
+	last_pid = call.pid;
+	record_count++;
+}
+
+bool TraceWriter::write( string path )
+{
+	TraceHeader header;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, TRACE_MAGIC, 4 );
+	header.version = TRACE_VERSION;
+	header.record_count = record_count;
+	header.string_count = strings.size();
+	header.strings_offset = sizeof(header);
+
+	/* the string table */
+	vector<unsigned int> offsets;
+	string characters;
+	for( int i = 0; i < strings.size(); i++ )
+	{
+		offsets.push_back( characters.size() );
+		characters += strings[i];
+	}
+	offsets.push_back( characters.size() );
+
+	unsigned long long position = header.strings_offset + offsets.size()*sizeof(unsigned int) + characters.size();
+	for( int i = 0; i < TRACE_COLUMNS; i++ )
+	{
+		header.column_offset[i] = position;
+		header.column_bytes[i] = columns[i].size();
+		position += columns[i].size();
+	}
+
+	FILE *out = fopen( path.c_str(), "wb" );
+	if( out == NULL )
+		return false;
+	fwrite( &header, sizeof(header), 1, out );
+	fwrite( &offsets[0], sizeof(unsigned int), offsets.size(), out );
+	fwrite( characters.data(), 1, characters.size(), out );
+	for( int i = 0; i < TRACE_COLUMNS; i++ )
+		if( columns[i].size() )
+			fwrite( &columns[i][0], 1, columns[i].size(), out );
+	return fclose( out ) == 0;
+}
+
+/* a memory mapped binary trace */
+class BinaryTrace
+{
+
+	private :
+	int fd;
+	const unsigned char *data;
+	size_t length;
+	const TraceHeader *header;
+	const unsigned int *offsets;
+	const char *characters;
+	/* where each column is being decoded, and where it ends */
+	const unsigned char *cursor[TRACE_COLUMNS];
+	const unsigned char *column_end[TRACE_COLUMNS];
+	string error_message;
+	unsigned long long position;
+	long long time, stream, bytes, pid;
+	/* one record per file, made the first time the file is seen */
+	vector<SystemCall*> files;
+	Object_Pool<SystemCall> records;
+
+	string text( unsigned int id )
+	{ return string( characters + offsets[id], offsets[id + 1] - offsets[id] ); }
+	/* set a field to a string of the table, without copying it when it already holds it */
+	void setText( string &field, unsigned int id )
+	{
+		if( field.size() != offsets[id + 1] - offsets[id] || field.compare( 0, string::npos, characters + offsets[id], offsets[id + 1] - offsets[id] ) != 0 )
+			field = text( id );
+	}
+	/* the next value of a column, and the string id it holds */
+	bool read( int, unsigned long long& );
+	bool readId( int, unsigned int& );
+	void fail( string );
+
+	public :
+	BinaryTrace( string );
+	~BinaryTrace();
+	bool isOpen()
+	{ return header != NULL; }
+	unsigned long long size()
+	{ return header ? header->record_count : 0; }
+
+	/* the next call ( NULL at the end, or at a record that does not decode ), every call to the same file shares one record */
+	SystemCall* next();
+	/* why the file was rejected or the records stopped early, "" if they did not */
+	string error()
+	{ return error_message; }
+};
+
+BinaryTrace::BinaryTrace( string path )
+{
+	data = NULL;
+	header = NULL;
+	length = 0;
+	position = 0;
+	time = 0;
+	stream = 0;
+	bytes = 0;
+	pid = 0;
+
+	fd = open( path.c_str(), O_RDONLY );
+	struct stat buff;
+	if( fd < 0 || fstat( fd, &buff ) < 0 )
+	{
+		error_message = "cannot read the file";
+		return;
+	}
+	/* the header of another version may be shorter */
+	if( buff.st_size < offsetof( TraceHeader, record_count ) )
+	{
+		error_message = "shorter than the header";
+		return;
+	}
+	length = buff.st_size;
+	void *map = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if( map == MAP_FAILED )
+	{
+		error_message = "cannot map the file";
+		return;
+	}
+	data = (const unsigned char *)map;
+	madvise( map, length, MADV_SEQUENTIAL );
+
+	/* nothing the header says is trusted until it is checked against the size of the file */
+	const TraceHeader *check = (const TraceHeader *)data;
+	if( memcmp( check->magic, TRACE_MAGIC, 4 ) != 0 || check->version != TRACE_VERSION )
+	{
+		error_message = "not a binary trace of this version ( convert the text trace again )";
+		return;
+	}
+	if( length < sizeof(TraceHeader) )
+	{
+		error_message = "shorter than the header";
+		return;
+	}
+	if( check->strings_offset < sizeof(TraceHeader) || check->strings_offset > length || check->strings_offset % sizeof(unsigned int)
+		|| check->string_count >= ( length - check->strings_offset )/sizeof(unsigned int) )
+	{
+		error_message = "the string table is outside the file";
+		return;
+	}
+	offsets = (const unsigned int *)( data + check->strings_offset );
+	characters = (const char *)( offsets + check->string_count + 1 );
+	size_t characters_length = length - ( (const unsigned char *)characters - data );
+	for( unsigned long long i = 0; i < check->string_count; i++ )
+		if( offsets[i] > offsets[i + 1] )
+		{
+			error_message = "the string table is corrupt";
+			return;
+		}
+	if( offsets[0] != 0 || offsets[check->string_count] > characters_length )
+	{
+		error_message = "the strings are outside the file";
+		return;
+	}
+	for( int i = 0; i < TRACE_COLUMNS; i++ )
+	{
+		if( check->column_offset[i] > length || check->column_bytes[i] > length - check->column_offset[i] )
+		{
+			error_message = "a column is outside the file";
+			return;
+		}
+		cursor[i] = data + check->column_offset[i];
+		column_end[i] = cursor[i] + check->column_bytes[i];
+	}
+	header = check;
+	files.resize( header->string_count, NULL );
+}
+
+BinaryTrace::~BinaryTrace()
+{
+	if( data != NULL )
+		munmap( (void *)data, length );
+	if( fd >= 0 )
+		close( fd );
+}
+
+void BinaryTrace::fail( string reason )
+{
+	char where[64];
+	snprintf( where, sizeof(where), " at record %llu", position );
+	error_message = reason + where;
+	header = NULL;
+}
+
+bool BinaryTrace::read( int column, unsigned long long &value )
+{
+	if( getVarint( cursor[column], column_end[column], value ) )
+		return true;
+	fail( "a column ends early" );
+	return false;
+}
+
+bool BinaryTrace::readId( int column, unsigned int &id )
+{
+	unsigned long long value;
+	if( !read( column, value ) )
+		return false;
+	if( value >= header->string_count )
+	{
+		fail( "a string id is past the string table" );
+		return false;
+	}
+	id = value;
+	return true;
+}
+
+SystemCall* BinaryTrace::next()
+{
+	if( header == NULL || position == header->record_count )
+		return NULL;
+	position++;
+
+	unsigned int type, file, program;
+	unsigned long long time_delta, stream_delta, bytes_delta, pid_delta;
+	if( !readId( COLUMN_TYPES, type ) || !readId( COLUMN_FILES, file ) || !read( COLUMN_TIMES, time_delta )
+		|| !read( COLUMN_STREAMS, stream_delta ) || !read( COLUMN_BYTES, bytes_delta )
+		|| !read( COLUMN_PIDS, pid_delta ) || !readId( COLUMN_PROGRAMS, program ) )
+		return NULL;
+	time += unzigzag( time_delta );
+	stream += unzigzag( stream_delta );
+	bytes += unzigzag( bytes_delta );
+	pid += unzigzag( pid_delta );
+
+	SystemCall *call = files[file];
+	if( call == NULL )
+	{
+		call = records.allocate();
+		call->file = text( file );
+		files[file] = call;
+	}
+	/* call types and programs are a handful of short strings */
+	setText( call->callType, type );
+	setText( call->program, program );
+	call->streamID = stream;
+	call->bytes = bytes;
+	call->offset = 0;
+	call->pid = pid;
+	long long seconds = ( time/1000000 ) % 86400;
+	call->hourTime = seconds/3600;
+	call->minuteTime = ( seconds/60 ) % 60;
+	call->secondTime = seconds % 60;
+	call->microSecondTime = time % 1000000;
+	return call;
+}
+
+#endif
@@ -0,0 +1,332 @@
+/* reads trace files and pipes, decompressing gzip ( zlib ) or zstd input on a separate thread while the trace is parsed */
+/* zstd needs -DHAVE_ZSTD -lzstd, gzip needs -lz unless built with -DNO_ZLIB */
+#ifndef Trace_Input_H
+#define Trace_Input_H
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+#define INPUT_CHUNK_SIZE (1 << 20) // bytes handed from the reader thread to the parser at a time
+#define INPUT_QUEUE_CHUNKS 8 // chunks decoded ahead of the parser
+
+enum InputFormat { INPUT_PLAIN, INPUT_GZIP, INPUT_ZSTD };
+
+/* a stream buffer filled by a reader thread */
+class ThreadedInput : public streambuf
+{
+
+	private :
+	int fd;
+	InputFormat format;
+	string prefix; // bytes already read to detect the format
+	thread reader;
+	/* decoded chunks waiting for the parser */
+	deque< vector<char> > queue;
+	bool finished, stopping;
+	mutex lock;
+	condition_variable not_empty, not_full;
+	vector<char> current;
+
+	void run();
+	/* hand a chunk to the parser ( false if the parser is gone ) */
+	bool push( vector<char>& );
+	/* read raw bytes, starting with the prefix */
+	long readRaw( char*, long );
+	void inflateGzip();
+	void decompressZstd();
+
+	protected :
+	int_type underflow();
+
+	public :
+	string error;
+	ThreadedInput( int, InputFormat, string );
+	~ThreadedInput();
+};
+
+ThreadedInput::ThreadedInput( int input, InputFormat type, string first_bytes )
+{
+	fd = input;
+	format = type;
+	prefix = first_bytes;
+	finished = false;
+	stopping = false;
+	setg( NULL, NULL, NULL );
+	reader = thread( &ThreadedInput::run, this );
+}
+
+ThreadedInput::~ThreadedInput()
+{
+	{
+		unique_lock<mutex> guard( lock );
+		stopping = true;
+		not_full.notify_all();
+	}
+	reader.join();
+}
+
+bool ThreadedInput::push( vector<char> &chunk )
+{
+	unique_lock<mutex> guard( lock );
+	while( queue.size() >= INPUT_QUEUE_CHUNKS && !stopping )
+		not_full.wait( guard );
+	if( stopping )
+		return false;
+	queue.push_back( vector<char>() );
+	queue.back().swap( chunk );
+	not_empty.notify_one();
+	return true;
+}
+
+long ThreadedInput::readRaw( char *buffer, long size )
+{
+	if( !prefix.empty() )
+	{
+		long count = prefix.size() < size ? prefix.size() : size;
+		memcpy( buffer, prefix.data(), count );
+		prefix.erase( 0, count );
+		return count;
+	}
+	long count;
+	do
+		count = read( fd, buffer, size );
+	while( count < 0 && errno == EINTR );
+	return count;
+}
+
+void ThreadedInput::run()
+{
+	if( format == INPUT_GZIP )
+		inflateGzip();
+	else if( format == INPUT_ZSTD )
+		decompressZstd();
+	else
+	{
+		vector<char> chunk( INPUT_CHUNK_SIZE );
+		long count;
+		while( (count = readRaw( &chunk[0], INPUT_CHUNK_SIZE )) > 0 )
+		{
+			chunk.resize( count );
+			if( !push( chunk ) )
+				break;
+			chunk.resize( INPUT_CHUNK_SIZE );
+		}
+	}
+	unique_lock<mutex> guard( lock );
+	finished = true;
+	not_empty.notify_one();
+}
+
+void ThreadedInput::inflateGzip()
+{
+#ifndef NO_ZLIB
+	vector<char> in( INPUT_CHUNK_SIZE ), chunk( INPUT_CHUNK_SIZE );
+	z_stream z;
+	memset( &z, 0, sizeof(z) );
+	/* 16 + MAX_WBITS : expect a gzip header */
+	if( inflateInit2( &z, 16 + MAX_WBITS ) != Z_OK )
+	{
+		error = "cannot start zlib";
+		return;
+	}
+	z.next_out = (Bytef *)&chunk[0];
+	z.avail_out = INPUT_CHUNK_SIZE;
+	/* ended : the last member was read to its end, so the input may stop here */
+	bool done = false, ended = false, end_of_input = false;
+	while( !done && !end_of_input )
+	{
+		long count = readRaw( &in[0], INPUT_CHUNK_SIZE );
+		end_of_input = ( count <= 0 );
+		z.next_in = (Bytef *)&in[0];
+		z.avail_in = end_of_input ? 0 : count;
+		/* at the end of the input zlib can still hold output that did not fit */
+		while( z.avail_in > 0 || end_of_input )
+		{
+			int result = inflate( &z, Z_NO_FLUSH );
+			/* Z_BUF_ERROR : nothing could be done, the stream is where it was */
+			if( result != Z_BUF_ERROR )
+				ended = ( result == Z_STREAM_END );
+			if( result == Z_STREAM_END )
+				inflateReset( &z ); // gzip files can hold several members
+			else if( result != Z_OK && result != Z_BUF_ERROR )
+			{
+				error = "corrupt gzip input";
+				done = true;
+				break;
+			}
+			if( z.avail_out == 0 )
+			{
+				if( !push( chunk ) )
+				{
+					done = true;
+					break;
+				}
+				chunk.resize( INPUT_CHUNK_SIZE );
+				z.next_out = (Bytef *)&chunk[0];
+				z.avail_out = INPUT_CHUNK_SIZE;
+			}
+			else if( result == Z_BUF_ERROR || end_of_input )
+				break;
+		}
+	}
+	if( z.avail_out < INPUT_CHUNK_SIZE && !done )
+	{
+		chunk.resize( INPUT_CHUNK_SIZE - z.avail_out );
+		push( chunk );
+	}
+	/* the input stopped in the middle of a member */
+	if( !done && !ended )
+		error = "truncated gzip input";
+	inflateEnd( &z );
+#else
+	error = "gzip input needs zlib ( built with NO_ZLIB )";
+#endif
+}
+
+void ThreadedInput::decompressZstd()
+{
+#ifdef HAVE_ZSTD
+	vector<char> in( INPUT_CHUNK_SIZE ), chunk( INPUT_CHUNK_SIZE );
+	ZSTD_DStream *z = ZSTD_createDStream();
+	ZSTD_initDStream( z );
+	ZSTD_outBuffer out = { &chunk[0], INPUT_CHUNK_SIZE, 0 };
+	/* remaining : 0 once a frame is decoded and flushed, so the input may stop there */
+	size_t remaining = 0;
+	bool done = false, end_of_input = false;
+	while( !done && !end_of_input )
+	{
+		long count = readRaw( &in[0], INPUT_CHUNK_SIZE );
+		end_of_input = ( count <= 0 );
+		ZSTD_inBuffer input = { &in[0], end_of_input ? 0 : (size_t)count, 0 };
+		/* at the end of the input the decoder is called until it has nothing more to give */
+		while( input.pos < input.size || end_of_input )
+		{
+			size_t written = out.pos;
+			size_t result = ZSTD_decompressStream( z, &out, &input );
+			if( ZSTD_isError( result ) )
+			{
+				error = "corrupt zstd input";
+				done = true;
+				break;
+			}
+			remaining = result;
+			if( out.pos == out.size )
+			{
+				if( !push( chunk ) )
+				{
+					done = true;
+					break;
+				}
+				chunk.resize( INPUT_CHUNK_SIZE );
+				out.dst = &chunk[0];
+				out.pos = 0;
+			}
+			else if( end_of_input && ( result == 0 || out.pos == written ) )
+				break;
+		}
+	}
+	if( out.pos && !done )
+	{
+		chunk.resize( out.pos );
+		push( chunk );
+	}
+	/* the input stopped in the middle of a frame */
+	if( !done && remaining != 0 )
+		error = "truncated zstd input";
+	ZSTD_freeDStream( z );
+#else
+	error = "zstd input needs a build with -DHAVE_ZSTD -lzstd";
+#endif
+}
+
+ThreadedInput::int_type ThreadedInput::underflow()
+{
+	if( gptr() < egptr() )
+		return traits_type::to_int_type( *gptr() );
+
+	unique_lock<mutex> guard( lock );
+	while( queue.empty() && !finished )
+		not_empty.wait( guard );
+	if( queue.empty() )
+		return traits_type::eof();
+	current.swap( queue.front() );
+	queue.pop_front();
+	not_full.notify_one();
+	guard.unlock();
+
+	setg( &current[0], &current[0], &current[0] + current.size() );
+	return traits_type::to_int_type( *gptr() );
+}
+
+/* a trace file ( or - for stdin ), compressed or not */
+class TraceInput
+{
+
+	private :
+	int fd;
+	ThreadedInput *buffer;
+	istream *in;
+
+	public :
+	InputFormat format;
+	TraceInput( string );
+	~TraceInput();
+	bool isOpen()
+	{ return in != NULL; }
+	istream& stream()
+	{ return *in; }
+	/* decompression problems, empty if none */
+	string error()
+	{ return buffer ? buffer->error : ""; }
+};
+
+TraceInput::TraceInput( string path )
+{
+	buffer = NULL;
+	in = NULL;
+	format = INPUT_PLAIN;
+	fd = ( path == "-" ) ? 0 : open( path.c_str(), O_RDONLY );
+	if( fd < 0 )
+		return;
+
+	/* detect the format from the magic number */
+	char magic[4];
+	long count = 0, result;
+	while( count < 4 && (result = read( fd, magic + count, 4 - count )) > 0 )
+		count += result;
+	if( count >= 2 && (unsigned char)magic[0] == 0x1f && (unsigned char)magic[1] == 0x8b )
+		format = INPUT_GZIP;
+	else if( count == 4 && (unsigned char)magic[0] == 0x28 && (unsigned char)magic[1] == 0xb5 && (unsigned char)magic[2] == 0x2f && (unsigned char)magic[3] == 0xfd )
+		format = INPUT_ZSTD;
+
+	buffer = new ThreadedInput( fd, format, string( magic, count ) );
+	in = new istream( buffer );
+}
+
+TraceInput::~TraceInput()
+{
+	delete in;
+	delete buffer;
+	if( fd > 0 )
+		close( fd );
+}
+
+#endif